@@ -0,0 +1,315 @@
+// nimble-cli: runs the merge profiles of a project without the GUI and prints a JSON report.
+//
+// Usage: nimble-cli <project dir> [options]
+//   --profile <file>[::<sheet>]	only run the profile of this file (and sheet), repeatable
+//   --rule <name>				only run rules with this name, repeatable
+//   --full-rebuild				ignore the mergefolder ledgers and merge every file again
+//   --no-save					merge only, nothing is saved
+//   --report <file>				write the JSON report to a file instead of stdout
+//
+// Exit code: 0 if everything worked, 1 if a merge or save reported errors, 2 on wrong usage.
+// Logging goes to stderr so stdout only carries the report.
+#include "project.h"
+#include "fileloader.h"
+#include "logging.h"
+#include "timer.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fl = fileloader;
+
+struct CliOptions {
+	std::string projectPath;
+	std::vector<std::pair<std::string, std::string>> profiles;	// file, sheet (empty for all sheets)
+	std::vector<std::string> rules;
+	std::string reportPath;
+	bool fullRebuild = false;
+	bool save = true;
+};
+
+struct ProfileResult {
+	std::string file;
+	std::string sheet;
+	MergeReport merge;
+	SaveReport save;
+	bool saved = false;
+	double loadMs = 0.0;
+	double mergeMs = 0.0;
+	double saveMs = 0.0;
+	std::vector<std::string> errors;	// errors outside of merging and saving
+};
+
+static void print_usage() {
+	std::cerr << "Usage: nimble-cli <project dir> [--profile <file>[::<sheet>]]... [--rule <name>]... [--full-rebuild] [--no-save] [--report <file>]\n";
+}
+
+static bool parse_args(int argc, char* argv[], CliOptions& options) {
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		auto next = [&](std::string& out) {
+			if (i + 1 >= argc)
+				return false;
+			out = argv[++i];
+			return true;
+			};
+		std::string value;
+		if (arg == "--profile") {
+			if (!next(value))
+				return false;
+			options.profiles.push_back(Splitlines(value, "::"));
+		}
+		else if (arg == "--rule") {
+			if (!next(value))
+				return false;
+			options.rules.push_back(value);
+		}
+		else if (arg == "--report") {
+			if (!next(options.reportPath))
+				return false;
+		}
+		else if (arg == "--full-rebuild") {
+			options.fullRebuild = true;
+		}
+		else if (arg == "--no-save") {
+			options.save = false;
+		}
+		else if (arg.starts_with("--") || !options.projectPath.empty()) {
+			return false;
+		}
+		else {
+			options.projectPath = arg;
+		}
+	}
+	return !options.projectPath.empty();
+}
+
+static std::string json_string(const std::string& s) {
+	std::string out = "\"";
+	for (unsigned char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char buf[8];
+				std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			}
+			else {
+				out += (char)c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+static std::string json_strings(const std::vector<std::string>& values) {
+	std::string out = "[";
+	for (std::size_t i = 0; i < values.size(); i++) {
+		out += (i ? ", " : "") + json_string(values[i]);
+	}
+	return out + "]";
+}
+
+static void write_merge_report(std::ostream& out, const MergeReport& report, const std::string& indent) {
+	out << "{\n";
+	out << indent << "\t\"rule\": " << json_string(report.rule) << ",\n";
+	out << indent << "\t\"type\": " << json_string(report.type) << ",\n";
+	out << indent << "\t\"join\": " << json_string(report.join) << ",\n";
+	out << indent << "\t\"rowsRead\": " << report.rowsRead << ",\n";
+	out << indent << "\t\"rowsWritten\": " << report.rowsWritten << ",\n";
+	out << indent << "\t\"cellsWritten\": " << report.cellsWritten << ",\n";
+	out << indent << "\t\"rowsAppended\": " << report.rowsAppended << ",\n";
+	out << indent << "\t\"rowsMatched\": " << report.rowsMatched << ",\n";
+	out << indent << "\t\"conflicts\": " << report.conflicts << ",\n";
+	out << indent << "\t\"skippedHeaders\": " << report.skippedHeaders << ",\n";
+	out << indent << "\t\"keyIndexes\": " << report.keyIndexes << ",\n";
+	out << indent << "\t\"indexesReused\": " << report.indexesReused << ",\n";
+	out << indent << "\t\"diagnostics\": [";
+	for (std::size_t i = 0; i < report.diagnostics.items.size(); i++) {
+		const Diagnostic& d = report.diagnostics.items[i];
+		out << (i ? ", " : "") << "{";
+		out << "\"code\": " << json_string(diag_code_name(d.code));
+		out << ", \"severity\": " << json_string(d.severity == Severity::Error ? "error" : "warning");
+		out << ", \"rule\": " << json_string(d.rule);
+		out << ", \"subject\": " << json_string(d.subject);
+		out << ", \"detail\": " << json_string(d.detail);
+		out << ", \"count\": " << d.count;
+		out << ", \"exampleRow\": " << d.exampleRow;
+		out << ", \"message\": " << json_string(diag_message(d));
+		out << "}";
+	}
+	out << "],\n";
+	out << indent << "\t\"rules\": [";
+	for (std::size_t i = 0; i < report.rules.size(); i++) {
+		out << (i ? ", " : "");
+		write_merge_report(out, report.rules[i], indent + "\t");
+	}
+	out << "]\n" << indent << "}";
+}
+
+static void write_save_report(std::ostream& out, const SaveReport& report, const std::string& indent) {
+	out << "{\n";
+	out << indent << "\t\"cellsWritten\": " << report.cellsWritten << ",\n";
+	out << indent << "\t\"cellsSkipped\": " << report.cellsSkipped << ",\n";
+	out << indent << "\t\"conflicts\": " << report.conflicts << ",\n";
+	out << indent << "\t\"warnings\": " << json_strings(report.warnings) << ",\n";
+	out << indent << "\t\"errors\": " << json_strings(report.errors) << "\n";
+	out << indent << "}";
+}
+
+static void write_report(std::ostream& out, const CliOptions& options, const std::vector<ProfileResult>& results, double totalMs, bool ok) {
+	out << "{\n";
+	out << "\t\"project\": " << json_string(options.projectPath) << ",\n";
+	out << "\t\"ok\": " << (ok ? "true" : "false") << ",\n";
+	out << "\t\"totalMs\": " << totalMs << ",\n";
+	out << "\t\"profiles\": [";
+	for (std::size_t i = 0; i < results.size(); i++) {
+		const ProfileResult& r = results[i];
+		out << (i ? ", " : "") << "{\n";
+		out << "\t\t\"file\": " << json_string(r.file) << ",\n";
+		out << "\t\t\"sheet\": " << json_string(r.sheet) << ",\n";
+		out << "\t\t\"loadMs\": " << r.loadMs << ",\n";
+		out << "\t\t\"mergeMs\": " << r.mergeMs << ",\n";
+		out << "\t\t\"saveMs\": " << r.saveMs << ",\n";
+		out << "\t\t\"errors\": " << json_strings(r.errors) << ",\n";
+		out << "\t\t\"merge\": ";
+		write_merge_report(out, r.merge, "\t\t");
+		out << ",\n\t\t\"save\": ";
+		if (r.saved)
+			write_save_report(out, r.save, "\t\t");
+		else
+			out << "null";
+		out << "\n\t}";
+	}
+	out << "]\n}\n";
+}
+
+static bool profile_selected(const CliOptions& options, const std::string& file, const std::string& sheet) {
+	if (options.profiles.empty())
+		return true;
+	for (const auto& [f, s] : options.profiles) {
+		if (f == file && (s.empty() || s == sheet))
+			return true;
+	}
+	return false;
+}
+
+static ProfileResult run_profile(Project& project, const CliOptions& options, const std::string& file, const std::string& sheet) {
+	ProfileResult result;
+	result.file = file;
+	result.sheet = sheet;
+	Timer t;
+	t.Start();
+	// loadfile returns quietly on a missing file, without the reset the previous profile's table would be merged again
+	project.activeFile = {};
+	project.loadfile(file, sheet);
+	t.Stop();
+	result.loadMs = t.GetElapsedMilliseconds();
+	if (!project.activeFile.loaded) {
+		result.errors.push_back("Could not load " + file + " (" + sheet + ")");
+		return result;
+	}
+	// Rules that are not selected sit out, the order of the selected ones stays the same
+	std::vector<MergeSettings>& all = *project.getCurrentMergeSettingsHandle();
+	std::vector<MergeSettings> rules;
+	std::vector<std::size_t> positions;
+	for (std::size_t i = 0; i < all.size(); i++) {
+		if (options.rules.empty() || std::find(options.rules.begin(), options.rules.end(), all[i].name) != options.rules.end()) {
+			rules.push_back(std::move(all[i]));
+			positions.push_back(i);
+		}
+	}
+	t.Start();
+	result.merge = MergeProfile(project.activeFile, rules, options.fullRebuild);
+	t.Stop();
+	result.mergeMs = t.GetElapsedMilliseconds();
+	for (std::size_t i = 0; i < rules.size(); i++) {
+		all[positions[i]] = std::move(rules[i]);
+	}
+	if (!options.save || result.merge.diagnostics.hasErrors())
+		return result;
+	t.Start();
+	result.save = save_sheet(project.activeFile.path, project.activeFile, *project.getCurrentSettingsHandle());
+	t.Stop();
+	result.saveMs = t.GetElapsedMilliseconds();
+	result.saved = true;
+	// Only a saved merge counts as merged for the next incremental run
+	if (result.save.errors.empty())
+		project.commitMergeLedgers();
+	return result;
+}
+
+int main(int argc, char* argv[]) {
+	CliOptions options;
+	if (!parse_args(argc, argv, options)) {
+		print_usage();
+		return 2;
+	}
+	// Logging writes to std::cout, the report keeps the real stdout
+	std::ostream stdoutStream(std::cout.rdbuf());
+	std::cout.rdbuf(std::cerr.rdbuf());
+
+	Timer total;
+	total.Start();
+	std::vector<ProfileResult> results;
+	bool ok = true;
+	try {
+		if (!fl::exists(options.projectPath)) {
+			logging::logerror("[nimble-cli] Project does not exist: %s", options.projectPath.c_str());
+			return 2;
+		}
+		Project project;
+		project.load(fl::getFilename(options.projectPath), options.projectPath);
+		// Collecting the profiles first, loading files changes the settings maps
+		std::vector<std::pair<std::string, std::string>> profiles;
+		for (const auto& [key, rules] : project.mergeSettings) {
+			const auto [file, sheet] = Splitlines(key, "\n");
+			if (!rules.empty() && profile_selected(options, file, sheet))
+				profiles.emplace_back(file, sheet);
+		}
+		std::sort(profiles.begin(), profiles.end());
+		for (const auto& [file, sheet] : profiles) {
+			logging::loginfo("[nimble-cli] Running profile: %s (%s)", file.c_str(), sheet.c_str());
+			try {
+				results.push_back(run_profile(project, options, file, sheet));
+			}
+			catch (const std::exception& e) {
+				ProfileResult failed;
+				failed.file = file;
+				failed.sheet = sheet;
+				failed.errors.push_back(e.what());
+				results.push_back(std::move(failed));
+			}
+			const ProfileResult& r = results.back();
+			ok = ok && r.errors.empty() && !r.merge.diagnostics.hasErrors() && r.save.errors.empty();
+		}
+		if (profiles.empty())
+			logging::logwarning("[nimble-cli] No merge profile selected");
+	}
+	catch (const std::exception& e) {
+		logging::logerror("[nimble-cli] %s", e.what());
+		ok = false;
+	}
+	total.Stop();
+
+	if (options.reportPath.empty()) {
+		write_report(stdoutStream, options, results, total.GetElapsedMilliseconds(), ok);
+	}
+	else {
+		std::ofstream out(fl::u8topath(options.reportPath), std::ios::binary | std::ios::trunc);
+		if (!out) {
+			logging::logerror("[nimble-cli] Could not write report: %s", options.reportPath.c_str());
+			return 1;
+		}
+		write_report(out, options, results, total.GetElapsedMilliseconds(), ok);
+	}
+	return ok ? 0 : 1;
+}
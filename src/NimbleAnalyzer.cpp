@@ -7,6 +7,10 @@
 #include "fileloader.h"
 #include "logging.h"
 #include "project.h"
+#include "aggregate.h"
+#include "columnstats.h"
+#include "filter.h"
+#include "sort.h"
 #include <raylib.h>
 #include "fileDialog.h"
 #include <string>
@@ -19,6 +23,7 @@ namespace fl = fileloader;
 #define TEXT_INPUT_WIDTH LISTBOX_WIDTH 
 #define CHILD_WINDOW_WIDTH (LISTBOX_WIDTH + 20)
 #define CHILD_WINDOW_HEIGHT 325.0f
+#define GROUP_PANEL_HEIGHT 300.0f
 
 // Storing data for project selection
 struct projectData {
@@ -36,6 +41,11 @@ static struct {
 	std::string selectedMerge;
 	std::string newMerge;
 	std::string newProject;
+	bool fullRebuild = false;	// ignore the mergefolder ledger on the next merge
+	// Dry run of a merge setting, waiting to be applied or discarded
+	std::string dryRunMerge;
+	MergeChangeSet dryRun;
+	MergeReport dryRunReport;
 
 	void clear() {
 		// Cleaning up the available projects
@@ -56,7 +66,19 @@ void NimbleAnalyzer::init(){
 
 static std::string g_search = "";
 static std::string g_search_header = "##NONE_HEADER";
-static std::vector<int> filteredRows;
+static FilterCache g_filter;
+static TrigramIndexCache g_index;
+static bool g_use_index = false;
+static bool g_use_packed = false;
+static std::vector<SortKey> g_sort_keys;	// clicked headers, shift click adds more
+static SortCache g_sort;
+static std::vector<int> g_sorted_rows;	// filter result in sort order
+static std::uint64_t g_rows_generation = 0;	// counts the changes of the filter result
+static bool g_show_groups = false;
+static GroupBySpec g_group_spec;
+static GroupByCache g_groups;
+static std::vector<SortKey> g_group_sort_keys;
+static SortCache g_group_sort;
 
 void NimbleAnalyzer::menubar(){
 	switch (viewmode) {
@@ -86,6 +108,7 @@ void NimbleAnalyzer::menubar(){
 			viewmode = ViewMode::ProjectSelection;
 		if (ImGui::Button("Just merge"))
 			viewmode = ViewMode::JustMerge;
+		undoRedo();
 		ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
 		ImGui::InputTextWithHint("##search", "search", &g_search);
 		ImGui::SetItemTooltip("Filter settings:\n\
@@ -94,7 +117,12 @@ void NimbleAnalyzer::menubar(){
 '<min;max>' Filters for everything inbetween min and max\n\
 '%c' At the start of the filter searches for everything that contains your text after\n\
 '!' At the start of the filter searches for everything that does not contain your text after\n\
-No Filters just searches for everything that starts with your searchtext", '%');
+No Filters just searches for everything that starts with your searchtext\n\
+\n\
+Queries search single headers and ignore the header selection:\n\
+'Station=3 AND (Result<0,5 OR NOT Serial%cX12)'\n\
+Operators: = != < <= > >= %c (contains) !%c (does not contain) ^ (starts with)\n\
+Names or values with spaces go in double quotes: \"Serial no\"^SN", '%', '%', '%', '%');
 		ImGui::SetNextItemWidth(LISTBOX_WIDTH);
 		if (ImGui::BeginCombo("Search only in header", g_search_header.c_str())) {
 			bool selected = (g_search_header == "##NONE_HEADER");
@@ -104,7 +132,7 @@ No Filters just searches for everything that starts with your searchtext", '%');
 			if (selected)
 				ImGui::SetItemDefaultFocus();
 			for (int n = 0; n < projectInfo.project.activeFile.columns.size(); n++) {
-				const std::string& s = header_label(projectInfo.project.activeFile.columns[n].key);
+				const std::string& s = column_label(projectInfo.project.activeFile.columns[n]);
 				bool selected = (s == g_search_header);
 				if (ImGui::Selectable(s.c_str(), &selected)) {
 					g_search_header = s;
@@ -114,6 +142,22 @@ No Filters just searches for everything that starts with your searchtext", '%');
 			}
 			ImGui::EndCombo();
 		}
+		ImGui::Checkbox("Substring index", &g_use_index);
+		ImGui::SetItemTooltip("Indexes the table in the background so '%c' searches only check candidate rows.\n\
+Costs extra memory on large tables.", '%');
+		ImGui::Checkbox("Packed text search", &g_use_packed);
+		ImGui::SetItemTooltip("Copies the searched text into one buffer per block of rows so '%c' and '^' searches scan faster.\n\
+Costs up to 256 MB, edits in searched blocks copy the block once.", '%');
+		ImGui::Checkbox("Group by", &g_show_groups);
+		ImGui::SetItemTooltip("Counts, sums and averages of the filtered rows per group");
+		if (g_filter.pending())
+			ImGui::TextUnformatted("Filtering...");
+		else if (g_show_groups && g_groups.pending())
+			ImGui::TextUnformatted("Grouping...");
+		else if (g_sort.pending())
+			ImGui::TextUnformatted("Sorting...");
+		else if (g_index.pending())
+			ImGui::TextUnformatted("Indexing...");
 		break;
 	case ViewMode::JustMerge:
 		if (ImGui::Button("Check for Updates")) {
@@ -123,10 +167,41 @@ No Filters just searches for everything that starts with your searchtext", '%');
 			viewmode = ViewMode::ProjectSelection;
 		if (ImGui::Button("Data view"))
 			viewmode = ViewMode::DataView;
+		undoRedo();
 		break;
 	}
 }
 
+void NimbleAnalyzer::undoRedo(){
+	TableHistory& history = projectInfo.project.history;
+	// Ctrl+Z / Ctrl+Y, but not while typing into a field
+	const bool shortcut = ImGui::GetIO().KeyCtrl && !ImGui::IsAnyItemActive();
+	ImGui::BeginDisabled(history.undoStack.empty());
+	const std::string undoLabel = history.undoStack.empty() ? "Undo" : "Undo " + history.undoStack.back().label;
+	if (ImGui::Button((undoLabel + "###undo").c_str()) || (!history.undoStack.empty() && shortcut && ImGui::IsKeyPressed(ImGuiKey_Z, false))) {
+		projectInfo.project.undo();
+		projectInfo.dryRunMerge.clear();
+	}
+	ImGui::EndDisabled();
+	ImGui::BeginDisabled(history.redoStack.empty());
+	const std::string redoLabel = history.redoStack.empty() ? "Redo" : "Redo " + history.redoStack.back().label;
+	if (ImGui::Button((redoLabel + "###redo").c_str()) || (!history.redoStack.empty() && shortcut && ImGui::IsKeyPressed(ImGuiKey_Y, false))) {
+		projectInfo.project.redo();
+		projectInfo.dryRunMerge.clear();
+	}
+	ImGui::EndDisabled();
+	int limitMB = (int)(history.memoryLimit / (1024 * 1024));
+	ImGui::SetNextItemWidth(LISTBOX_WIDTH / 2);
+	if (ImGui::InputInt("Undo memory (MB)", &limitMB, 64)) {
+		history.memoryLimit = (std::size_t)std::max(limitMB, 0) * 1024 * 1024;
+		history.trim(projectInfo.project.activeFile);
+	}
+	// Walking every chunk is too slow to do each frame, only count while the tooltip shows
+	if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+		ImGui::SetTooltip("Older undo steps are dropped once they hold more memory than this\nIn use: %zu MB",
+			history.memoryUsage(projectInfo.project.activeFile) / (1024 * 1024));
+}
+
 void NimbleAnalyzer::contentwindow(){
 	switch (viewmode) {
 	case ViewMode::ProjectSelection:
@@ -150,7 +225,16 @@ void NimbleAnalyzer::contentwindow(){
 		ImGui::EndChild();
 		break;
 	case ViewMode::DataView:
+		if (!g_show_groups) {
+			dataView();
+			break;
+		}
+		ImGui::BeginChild("Rows", { 0, -GROUP_PANEL_HEIGHT });
 		dataView();
+		ImGui::EndChild();
+		ImGui::BeginChild("Group by", { 0, 0 }, true);
+		groupByPanel();
+		ImGui::EndChild();
 		break;
 	case ViewMode::JustMerge:
 		justMerge();
@@ -164,114 +248,25 @@ void NimbleAnalyzer::contentwindow(){
 	}
 }
 
+bool NimbleAnalyzer::busy() const {
+	return g_filter.pending() || g_sort.pending() || g_groups.pending() || g_group_sort.pending() || g_index.pending();
+}
+
 void NimbleAnalyzer::cleanup(){
 	if(projectInfo.project.loaded)
 		projectInfo.project.save();
 	projectInfo.clear();
 }
 
-static bool RowMatchesFilter(int r) {
-		bool skip = true;
-		if (!g_search.empty()) {
-			for (int c = 0; c < (int)projectInfo.project.activeFile.columns.size(); ++c) {
-				const auto& cell = projectInfo.project.activeFile.columns[c].values[r];
-				if (g_search_header != "##NONE_HEADER" && g_search_header != header_label(projectInfo.project.activeFile.columns[c].key))
-					continue;
-				if (g_search.starts_with("<") && g_search.ends_with(">")) {
-					auto* i = std::get_if<std::int64_t>(&cell.first);
-					auto* d = std::get_if<double>(&cell.first);
-					std::string s = g_search;
-					s = normalize_decimal(s);
-					s.erase(0, 1);
-					s.erase(s.size() - 1, 1);
-					auto split = Splitlines(s, ";");
-					double value1;
-					double value2;
-					auto result = std::from_chars(split.first.data(), split.first.data() + split.first.size(), value1);
-					if (!(result.ec == std::errc() && result.ptr == split.first.data() + split.first.size())) {
-						continue;
-					}
-					result = std::from_chars(split.second.data(), split.second.data() + split.second.size(), value2);
-					if (!(result.ec == std::errc() && result.ptr == split.second.data() + split.second.size())) {
-						continue;
-					}
-					if (i && *i > value1 && *i < value2) {
-						skip = false;
-						break;
-					}
-					else if(d && *d > value1 && *d < value2) {
-						skip = false;
-						break;
-					}
-				}
-				else if (g_search.starts_with("<")) {
-					auto* i = std::get_if<std::int64_t>(&cell.first);
-					auto* d = std::get_if<double>(&cell.first);
-					std::string s = g_search;
-					s = normalize_decimal(s);
-					s.erase(0, 1);
-					double value;
-					auto result = std::from_chars(s.data(), s.data() + s.size(), value);
-					if (!(result.ec == std::errc() && result.ptr == s.data() + s.size())) {
-						continue;
-					}
-					if (i && *i < value) {
-						skip = false;
-						break;
-					}
-					else if(d && *d < value) {
-						skip = false;
-						break;
-					}
-				}
-				else if (g_search.starts_with(">")) {
-					auto* i = std::get_if<std::int64_t>(&cell.first);
-					auto* d = std::get_if<double>(&cell.first);
-					std::string s = g_search;
-					s = normalize_decimal(s);
-					s.erase(0, 1);
-					double value;
-					auto result = std::from_chars(s.data(), s.data() + s.size(), value);
-					if (!(result.ec == std::errc() && result.ptr == s.data() + s.size())) {
-						continue;
-					}
-					if (i && *i > value) {
-						skip = false;
-						break;
-					}
-					else if(d && *d > value) {
-						skip = false;
-						break;
-					}
-				}
-				else if (g_search.starts_with("!")) {
-					std::string s = g_search;
-					s.erase(0, 1);
-					if (!cell.second.contains(s)) {
-						skip = false;
-					}
-					else {
-						skip = true;
-						break;
-					}
-				}
-				else if (g_search.starts_with("%")) {
-					std::string s = g_search;
-					s.erase(0, 1);
-					if (cell.second.contains(s)) {
-						skip = false;
-						break;
-					}
-				}
-				else if (cell.second.starts_with(g_search)) {
-					skip = false;
-					break;
-				}
-			}
-		}
-		else
-			skip = false;
-		return !skip;
+// Columns of the current table that are not scrolled out of view, only their cells get widgets.
+// keep is listed even if it is hidden, the cell being edited needs its widget to commit or cancel.
+// Fills visible, a buffer the caller keeps between frames. Valid once the first row of the frame started.
+static void visible_columns(int count, std::vector<int>& visible, int keep = -1) {
+	visible.clear();
+	for (int c = 0; c < count; ++c) {
+		if (c == keep || (ImGui::TableGetColumnFlags(c) & ImGuiTableColumnFlags_IsVisible))
+			visible.push_back(c);
+	}
 }
 
 struct ActiveCell { int row = -1; int col = -1; };
@@ -289,17 +284,51 @@ void NimbleAnalyzer::dataView(){
 		ImGuiTableFlags_RowBg |
 		ImGuiTableFlags_Resizable |
 		ImGuiTableFlags_ScrollY |
-		ImGuiTableFlags_ScrollX;
+		ImGuiTableFlags_ScrollX |
+		ImGuiTableFlags_Sortable |
+		ImGuiTableFlags_SortMulti |
+		ImGuiTableFlags_SortTristate;
 
 	if (ImGui::BeginTable("##sheet_table", (int)projectInfo.project.activeFile.columns.size(), flags)) {
 		ImGui::TableSetupScrollFreeze(0, 1);
 		for (int c = 0; c < (int)projectInfo.project.activeFile.columns.size(); ++c) {
 			const auto& col = projectInfo.project.activeFile.columns[c];
-			ImGui::TableSetupColumn(header_label(col.key).c_str(), ImGuiTableColumnFlags_WidthFixed, 140.0f);
+			ImGui::TableSetupColumn(column_label(col).c_str(), ImGuiTableColumnFlags_WidthFixed, 140.0f, column_id(col));
+		}
+		// Headers show the statistics of their column on hover
+		ImGui::TableNextRow(ImGuiTableRowFlags_Headers);
+		static std::vector<int> visibleColumns;
+		visible_columns((int)projectInfo.project.activeFile.columns.size(), visibleColumns, g_active.col);
+		for (const int c : visibleColumns) {
+			const auto& col = projectInfo.project.activeFile.columns[c];
+			ImGui::TableSetColumnIndex(c);
+			ImGui::TableHeader(column_label(col).c_str());
+			if (!ImGui::IsItemHovered(ImGuiHoveredFlags_DelayNormal))
+				continue;
+			const StatsSummary& stats = GetColumnStats(col);
+			ImGui::BeginTooltip();
+			ImGui::Text("Rows: %zu\nEmpty: %zu\nNumbers: %zu\nDistinct: ~%zu", stats.rows, stats.empty, stats.numbers, stats.distinct());
+			if (stats.numbers)
+				ImGui::Text("Min: %s\nMax: %s\nMean: %s", to_display(stats.min).c_str(), to_display(stats.max).c_str(), to_display(stats.mean()).c_str());
+			ImGui::EndTooltip();
 		}
-		ImGui::TableHeadersRow();
 
-		filterRows();
+		bool keysChanged = false;
+		if (ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs(); specs && specs->SpecsDirty) {
+			g_sort_keys.clear();
+			for (int i = 0; i < specs->SpecsCount; ++i) {
+				const ImGuiTableColumnSortSpecs& spec = specs->Specs[i];
+				g_sort_keys.push_back({ (ColId)spec.ColumnIndex, spec.SortDirection == ImGuiSortDirection_Descending });
+			}
+			specs->SpecsDirty = false;
+			keysChanged = true;
+		}
+		// Sorting only reorders the rows that are shown, the table keeps its order
+		const bool filtered = filterRows();
+		const bool sorted = g_sort.update(projectInfo.project.activeFile, g_sort_keys);
+		if (!g_sort_keys.empty() && (filtered || sorted || keysChanged))
+			g_sorted_rows = OrderRows(g_sort.order, g_filter.rows);
+		const std::vector<int>& filteredRows = g_sort_keys.empty() ? g_filter.rows : g_sorted_rows;
 
 		ImGuiListClipper clipper;
 		clipper.Begin((int)filteredRows.size());
@@ -308,7 +337,7 @@ void NimbleAnalyzer::dataView(){
 			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
 				int r = filteredRows[i];
 				ImGui::TableNextRow();
-				for (int c = 0; c < (int)projectInfo.project.activeFile.columns.size(); ++c) {
+				for (const int c : visibleColumns) {
 					ImGui::TableSetColumnIndex(c);
 
 					// safety
@@ -317,7 +346,7 @@ void NimbleAnalyzer::dataView(){
 						continue;
 					}
 
-					auto& cell = projectInfo.project.activeFile.columns[c].values[r];	// pair<ExcelValue, string>
+					const auto& cell = projectInfo.project.activeFile.columns[c].values[r];	// pair<ExcelValue, string>
 					ImGui::PushID(r);
 					ImGui::PushID(c);
 
@@ -327,6 +356,7 @@ void NimbleAnalyzer::dataView(){
 						ImGui::PushID(&cell);
 						if(ImGui::Selectable(cell.second.c_str())){
 							g_active = { r, c };
+							editBuf[CellKey{ c, r }] = cell.second;
 							ImGui::SetKeyboardFocusHere();
 						}
 						ImGui::PopID();
@@ -335,17 +365,26 @@ void NimbleAnalyzer::dataView(){
 						ImGuiInputTextFlags inputFlags =
 							ImGuiInputTextFlags_EnterReturnsTrue;
 						
-						bool enterPressed = ImGui::InputText("##cell", &cell.second, inputFlags);
+						// edited in a buffer, the table only changes on commit so it can be undone
+						std::string& text = editBuf[CellKey{ c, r }];
+						bool enterPressed = ImGui::InputText("##cell", &text, inputFlags);
 
 						bool commit = enterPressed || ImGui::IsItemDeactivatedAfterEdit();
 						if (commit) {
-							cell.first = parse_value_auto(cell.second);
-							cell.second = to_display(cell.first);
+							ExcelValue value = parse_value_auto(text);
+							if (!(value == cell.first)) {
+								projectInfo.project.snapshot("Edit " + column_label(projectInfo.project.activeFile.columns[c]) + " row " + std::to_string(r + 1));
+								auto& edited = projectInfo.project.activeFile.columns[c].values.edit(r);
+								edited.second = to_display(value);
+								edited.first = std::move(value);
+								projectInfo.project.activeFile.touch();
+							}
+							editBuf.erase(CellKey{ c, r });
 							g_active = { -1, -1 };
 						}
 						// escape cancels
-						if (ImGui::IsKeyPressed(ImGuiKey_Escape)) {
-							cell.second = to_display(cell.first);
+						else if (ImGui::IsKeyPressed(ImGuiKey_Escape)) {
+							editBuf.erase(CellKey{ c, r });
 							g_active = { -1, -1 };
 						}
 					}
@@ -372,52 +411,12 @@ void NimbleAnalyzer::justMerge(){
 	if (!msv)
 		return;
 	if (ImGui::Button("Merge")) {
-		for (auto& ms : (*msv)) {
-			if (!ms.sourceFile.loaded) {
-				continue;
-			}
-			logging::logwarning("[NimbleAnalyzer::justMerge] Merging: %s\n\
-								For file: %s", ms.name.c_str(), projectInfo.project.activeFile.path.c_str());
-			if (ms.mergefolder.empty()) {
-				MergeReport report = MergeTables(projectInfo.project.activeFile, ms.sourceFile, ms);
-				if (!report.warnings.empty()) {
-					for (const auto& msg : report.warnings) {
-						logging::logwarning("[Merge Report] %s", msg.c_str());
-					}
-				}
-				if (!report.errors.empty()) {
-					for (const auto& msg : report.errors) {
-						logging::logerror("[Merge Report] %s", msg.c_str());
-					}
-				}
-			}
-			else {
-				const std::vector<std::string> files = fl::iteratePath(ms.mergefolder, false);
-				for (const std::string& file : files) {
-					try {
-						std::string f = file;
-						std::transform(f.begin(), f.end(), f.begin(), ::tolower);
-						if (f.ends_with(".xlsx") || f.ends_with(".csv")) {
-							SheetTable srcTable = load_sheet(file, ms.sourceFile.activeSheet, ms.sheetSettings);
-							MergeReport report = MergeTables(projectInfo.project.activeFile, srcTable, ms);
-							if (!report.warnings.empty()) {
-								for (const auto& msg : report.warnings) {
-									logging::logwarning("[Merge Report] %s", msg.c_str());
-								}
-							}
-							if (!report.errors.empty()) {
-								for (const auto& msg : report.errors) {
-									logging::logerror("[Merge Report] %s", msg.c_str());
-								}
-							}
-						}
-					}
-					catch (const std::exception& e) {
-						logging::logerror(e.what());
-					}
-				}
-			}
-		}
+		projectInfo.project.snapshot("Merge all");
+		logging::logwarning("[NimbleAnalyzer::justMerge] Merging all rules\n\
+							For file: %s", projectInfo.project.activeFile.path.c_str());
+		const MergeReport report = MergeProfile(projectInfo.project.activeFile, *msv, projectInfo.fullRebuild);
+		log_diagnostics(report.diagnostics);
+		projectInfo.fullRebuild = false;
 	}
 	ImGui::SameLine();
 	if (ImGui::Button("Save")) {
@@ -432,7 +431,13 @@ void NimbleAnalyzer::justMerge(){
 				logging::logwarning("%s", warning.c_str());
 			}
 		}
+		else {
+			projectInfo.project.commitMergeLedgers();
+		}
 	}
+	ImGui::SameLine();
+	ImGui::Checkbox("Full rebuild", &projectInfo.fullRebuild);
+	ImGui::SetItemTooltip("Merge every file of the mergefolders again, even if it was already merged before");
 }
 
 void NimbleAnalyzer::update(){
@@ -544,6 +549,7 @@ void NimbleAnalyzer::projectSelection() {
 					projectInfo.project.save();
 				projectInfo.project.load(project.name, project.path);
 				projectInfo.selectedMerge.clear();
+				projectInfo.dryRunMerge.clear();
 			}
 		}
 		ImGui::EndListBox();
@@ -593,6 +599,7 @@ void NimbleAnalyzer::fileSelection(){
 				projectInfo.project.save();
 				projectInfo.project.loadfile(file);
 				projectInfo.selectedMerge.clear();
+				projectInfo.dryRunMerge.clear();
 			}
 			ImGui::SetItemTooltip(file.c_str());
 		}
@@ -622,6 +629,9 @@ void NimbleAnalyzer::fileSelection(){
 				logging::logwarning("%s", warning.c_str());
 			}
 		}
+		else {
+			projectInfo.project.commitMergeLedgers();
+		}
 	}
 }
 
@@ -639,6 +649,7 @@ void NimbleAnalyzer::sheetSelection(){
 					sheet
 				);
 				projectInfo.selectedMerge.clear();
+				projectInfo.dryRunMerge.clear();
 			}
 		}
 		ImGui::EndListBox();
@@ -666,8 +677,7 @@ void NimbleAnalyzer::showHeaders(){
 	ImGui::TextUnformatted("Headers found");
 	if (ImGui::BeginListBox("## Show Headers", { LISTBOX_WIDTH, LISTBOX_HEIGHT })) {
 		for (const auto& header : projectInfo.project.activeFile.columns) {
-			const std::string label = header_label(header.key);
-			ImGui::Selectable(label.c_str());
+			ImGui::Selectable(column_label(header).c_str());
 		}
 		ImGui::EndListBox();
 	}
@@ -746,47 +756,32 @@ void NimbleAnalyzer::mergeSettings(){
 	}
 	ImGui::SameLine();
 	if (ImGui::Button("Merge") && ms->sourceFile.loaded && projectInfo.selectedMerge != "") {
+		projectInfo.project.snapshot("Merge " + ms->name);
 		if (ms->mergefolder.empty()) {
 			MergeReport report = MergeTables(projectInfo.project.activeFile, ms->sourceFile, *ms);
-			if (!report.warnings.empty()) {
-				for (const auto& msg : report.warnings) {
-					logging::logwarning("[Merge Report] %s", msg.c_str());
-				}
-			}
-			if (!report.errors.empty()) {
-				for (const auto& msg : report.errors) {
-					logging::logerror("[Merge Report] %s", msg.c_str());
-				}
-			}
+			log_diagnostics(report.diagnostics);
 		}
 		else {
-			const std::vector<std::string> files = fl::iteratePath(ms->mergefolder, false);
-			for (const std::string& file : files) {
-				try {
-					std::string f = file;
-					std::transform(f.begin(), f.end(), f.begin(), ::tolower);
-					if (f.ends_with(".xlsx") || f.ends_with(".csv")) {
-						SheetTable srcTable = load_sheet(file, ms->sourceFile.activeSheet, ms->sheetSettings);
-						MergeReport report = MergeTables(projectInfo.project.activeFile, srcTable, *ms);
-						if (!report.warnings.empty()) {
-							for (const auto& msg : report.warnings) {
-								logging::logwarning("[Merge Report] %s", msg.c_str());
-							}
-						}
-						if (!report.errors.empty()) {
-							for (const auto& msg : report.errors) {
-								logging::logerror("[Merge Report] %s", msg.c_str());
-							}
-						}
-					}
-				}
-				catch (const std::exception& e) {
-					logging::logerror(e.what());
-				}
+			const std::vector<MergeReport> reports = MergeFolder(projectInfo.project.activeFile, *ms, projectInfo.fullRebuild);
+			for (const auto& report : reports) {
+				log_diagnostics(report.diagnostics);
 			}
 		}
+		projectInfo.fullRebuild = false;
+		projectInfo.dryRunMerge.clear();
+	}
+	if (ms->mergefolder.empty() && ms->useKey()) {
+		ImGui::SameLine();
+		if (ImGui::Button("Dry run") && ms->sourceFile.loaded) {
+			projectInfo.dryRunReport = {};
+			projectInfo.dryRun = DryRunMerge(projectInfo.project.activeFile, ms->sourceFile, *ms, projectInfo.dryRunReport);
+			projectInfo.dryRunMerge = ms->name;
+		}
+		ImGui::SetItemTooltip("Shows what the merge would change without changing the file");
 	}
 	ImGui::PopID();
+	if (projectInfo.dryRunMerge == ms->name)
+		mergePreview();
 	// sourcefile
 	ImGui::SeparatorText("Sourcefile settings");
 	if (ImGui::Button("Add sourcefile")) {
@@ -824,6 +819,8 @@ void NimbleAnalyzer::mergeSettings(){
 		if (path != "") {
 			convertContentToUTF8(&path);
 			ms->mergefolder = path;
+			ms->ledger.clear();
+			ms->pendingLedger.clear();
 		}
 	}
 	if (ms->mergefolder != "") {
@@ -831,17 +828,23 @@ void NimbleAnalyzer::mergeSettings(){
 		ImGui::SameLine();
 		if (ImGui::Button("X")) {
 			ms->mergefolder = "";
+			ms->ledger.clear();
+			ms->pendingLedger.clear();
 		}
 		ImGui::PopID();
 	}
+	ImGui::SameLine();
+	ImGui::Checkbox("Full rebuild", &projectInfo.fullRebuild);
+	ImGui::SetItemTooltip("Merge every file of the mergefolder again, even if it was already merged before");
 	ImGui::Text("Mergefolder: %s", ms->mergefolder.c_str());
+	ImGui::Text("Already merged files: %zu (%zu unsaved)", ms->ledger.size(), ms->pendingLedger.size());
 	// Key
 	ImGui::SeparatorText("Header Key");
 	ImGui::TextUnformatted("Dst Header key                     Src Header key");
 	ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
 	if (ImGui::BeginCombo("##Dst Header Key", header_label(ms->key.dstHeader).c_str())) {
 		for (const auto& dst_key : projectInfo.project.activeFile.columns) {
-			if (ImGui::Selectable(header_label(dst_key.key).c_str())) {
+			if (ImGui::Selectable(column_label(dst_key).c_str())) {
 				ms->key.dstHeader = dst_key.key;
 			}
 		}
@@ -851,7 +854,7 @@ void NimbleAnalyzer::mergeSettings(){
 	ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
 	if (ImGui::BeginCombo("##Src Header Key", header_label(ms->key.srcHeader).c_str())) {
 		for (const auto& src_key : ms->sourceFile.columns) {
-			if (ImGui::Selectable(header_label(src_key.key).c_str())) {
+			if (ImGui::Selectable(column_label(src_key).c_str())) {
 				ms->key.srcHeader = src_key.key;
 			}
 		}
@@ -860,12 +863,58 @@ void NimbleAnalyzer::mergeSettings(){
 	ImGui::SameLine();
 	if (ImGui::Button("Clear")) {
 		ms->key = {};
+		ms->extraKeys.clear();
 	}
 	ImGui::SameLine();
 	ImGui::Checkbox("Reverse header", &ms->reverseKey);
 	ImGui::SetItemTooltip("Sets the key headers to work in reverse.\n\
 Unticked: Only import if the headers value from the src file does NOT exist in dst file\n\
 Ticked: Only import if the headers value from the src file does exist in dst file and fill row with data");
+	// key normalization
+	ImGui::Checkbox("Trim key", &ms->keyNormalization.trim);
+	ImGui::SetItemTooltip("Ignore whitespace around key values");
+	ImGui::SameLine();
+	ImGui::Checkbox("Ignore case", &ms->keyNormalization.caseFold);
+	ImGui::SetItemTooltip("'abc' matches 'ABC'");
+	ImGui::SameLine();
+	ImGui::Checkbox("Numeric keys", &ms->keyNormalization.numeric);
+	ImGui::SetItemTooltip("Numbers stored as text match numbers: '421,0' matches 421");
+	ImGui::SameLine();
+	ImGui::Checkbox("Strip leading zeros", &ms->keyNormalization.stripLeadingZeros);
+	ImGui::SetItemTooltip("'0421' matches '421'\n\
+Unticked: keys with leading zeros are always compared as text");
+	// composite key
+	int keyCount = ms->extraKeys.size();
+	ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH / 2);
+	if (ImGui::InputInt("Additional key headers", &keyCount)) {
+		if (keyCount < 0)
+			keyCount = 0;
+		ms->extraKeys.resize(keyCount);
+	}
+	ImGui::SetItemTooltip("Rows only match if the header key and all additional key headers match");
+	for (auto& key : ms->extraKeys) {
+		ImGui::PushID(&key);
+		ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
+		if (ImGui::BeginCombo("##Dst Header Key", header_label(key.dstHeader).c_str())) {
+			for (const auto& dst_key : projectInfo.project.activeFile.columns) {
+				if (ImGui::Selectable(column_label(dst_key).c_str())) {
+					key.dstHeader = dst_key.key;
+				}
+			}
+			ImGui::EndCombo();
+		}
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
+		if (ImGui::BeginCombo("##Src Header Key", header_label(key.srcHeader).c_str())) {
+			for (const auto& src_key : ms->sourceFile.columns) {
+				if (ImGui::Selectable(column_label(src_key).c_str())) {
+					key.srcHeader = src_key.key;
+				}
+			}
+			ImGui::EndCombo();
+		}
+		ImGui::PopID();
+	}
 	// add rules
 	ImGui::SeparatorText("Merging headers");
 	int size = ms->mergeHeaders.size();
@@ -893,7 +942,7 @@ Ticked: Only import if the headers value from the src file does exist in dst fil
 		ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
 		if (ImGui::BeginCombo("##Dst Header Key", header_label(headers.dstHeader).c_str())) {
 			for (const auto& dst_key : projectInfo.project.activeFile.columns) {
-				if (ImGui::Selectable(header_label(dst_key.key).c_str())) {
+				if (ImGui::Selectable(column_label(dst_key).c_str())) {
 					headers.dstHeader = dst_key.key;
 				}
 			}
@@ -903,7 +952,7 @@ Ticked: Only import if the headers value from the src file does exist in dst fil
 		ImGui::SetNextItemWidth(TEXT_INPUT_WIDTH);
 		if (ImGui::BeginCombo("##Src Header Key", header_label(headers.srcHeader).c_str())) {
 			for (const auto& src_key : ms->sourceFile.columns) {
-				if (ImGui::Selectable(header_label(src_key.key).c_str())) {
+				if (ImGui::Selectable(column_label(src_key).c_str())) {
 					headers.srcHeader = src_key.key;
 				}
 			}
@@ -913,12 +962,202 @@ Ticked: Only import if the headers value from the src file does exist in dst fil
 	}
 }
 
-void NimbleAnalyzer::filterRows(){
-	filteredRows.clear();
-	filteredRows.reserve((int)projectInfo.project.activeFile.rowCount);
+void NimbleAnalyzer::mergePreview(){
+	SheetTable& dst = projectInfo.project.activeFile;
+	MergeChangeSet& changes = projectInfo.dryRun;
+	ImGui::SeparatorText("Dry run");
+	ImGui::Text("Rows matched: %zu   Rows appended: %zu   Cells written: %zu   Overwritten: %zu   Conflicting: %zu",
+		changes.rowsMatched, changes.rowsAppended, projectInfo.dryRunReport.cellsWritten, changes.cellsOverwritten, changes.cellsConflicting);
+	if (ImGui::Button("Apply")) {
+		MergeReport report = projectInfo.dryRunReport;
+		// A stale change set is rejected by ApplyChangeSet, only snapshot when it will apply
+		if (changes.current(dst))
+			projectInfo.project.snapshot("Merge " + projectInfo.dryRunMerge);
+		ApplyChangeSet(dst, changes, report);
+		log_diagnostics(report.diagnostics);
+		projectInfo.dryRunMerge.clear();
+		return;
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Discard")) {
+		changes = {};
+		projectInfo.dryRunMerge.clear();
+		return;
+	}
+	if (changes.cells.empty())
+		return;
+	ImGuiTableFlags flags =
+		ImGuiTableFlags_Borders |
+		ImGuiTableFlags_RowBg |
+		ImGuiTableFlags_Resizable |
+		ImGuiTableFlags_ScrollY;
+	if (ImGui::BeginTable("##dry_run", 4, flags, ImVec2(0.0f, LISTBOX_HEIGHT))) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Header");
+		ImGui::TableSetupColumn("Row");
+		ImGui::TableSetupColumn("Current");
+		ImGui::TableSetupColumn("New");
+		ImGui::TableHeadersRow();
+		ImGuiListClipper clipper;
+		clipper.Begin((int)changes.cells.size());
+		while (clipper.Step()) {
+			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+				const auto& change = changes.cells[i];
+				// safety, the table might have been reloaded
+				if (change.column >= dst.columns.size() || change.row >= dst.columns[change.column].values.size())
+					continue;
+				const Column& col = dst.columns[change.column];
+				ImGui::TableNextRow();
+				ImGui::TableSetColumnIndex(0);
+				ImGui::TextUnformatted(column_label(col).c_str());
+				ImGui::TableSetColumnIndex(1);
+				ImGui::Text("%u", change.row + 1);
+				ImGui::TableSetColumnIndex(2);
+				ImGui::TextUnformatted(col.values[change.row].second.c_str());
+				ImGui::TableSetColumnIndex(3);
+				ImGui::TextUnformatted(changes.value(change).second.c_str());
+			}
+		}
+		ImGui::EndTable();
+	}
+}
+
+bool NimbleAnalyzer::filterRows(){
+	// Only filters again if the search, the header or the table changed
+	const std::string header = g_search_header == "##NONE_HEADER" ? "" : g_search_header;
+	if (g_use_index)
+		g_index.update(projectInfo.project.activeFile);
+	else if (g_index.index || g_index.pending())
+		g_index.clear();
+	g_filter.index = g_index.index;
+	if (g_use_packed && !g_filter.packed)
+		g_filter.packed = std::make_shared<PackedStringCache>();
+	else if (!g_use_packed)
+		g_filter.packed.reset();
+	if (!g_filter.update(projectInfo.project.activeFile, g_search, header))
+		return false;
+	g_rows_generation++;
+	return true;
+}
+
+void NimbleAnalyzer::groupByPanel(){
+	SheetTable& table = projectInfo.project.activeFile;
+	if (table.columns.empty()) {
+		ImGui::TextUnformatted("No data available.");
+		return;
+	}
+	// Group columns, several can be checked
+	std::string groups;
+	for (const ColId c : g_group_spec.groups) {
+		if (c < table.columns.size())
+			groups += (groups.empty() ? "" : ", ") + column_label(table.columns[c]);
+	}
+	ImGui::SetNextItemWidth(LISTBOX_WIDTH);
+	if (ImGui::BeginCombo("Group by", groups.empty() ? "All rows" : groups.c_str())) {
+		for (ColId c = 0; c < (ColId)table.columns.size(); ++c) {
+			auto it = std::find(g_group_spec.groups.begin(), g_group_spec.groups.end(), c);
+			bool selected = it != g_group_spec.groups.end();
+			if (ImGui::Checkbox(column_label(table.columns[c]).c_str(), &selected)) {
+				if (selected)
+					g_group_spec.groups.push_back(c);
+				else
+					g_group_spec.groups.erase(it);
+			}
+		}
+		ImGui::EndCombo();
+	}
+	// New aggregate
+	static Aggregate newAggregate;
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(100.0f);
+	if (ImGui::BeginCombo("##aggregate_op", aggregate_op_name(newAggregate.op))) {
+		for (const AggregateOp op : { AggregateOp::Count, AggregateOp::Sum, AggregateOp::Min, AggregateOp::Max, AggregateOp::Mean, AggregateOp::DistinctCount }) {
+			if (ImGui::Selectable(aggregate_op_name(op), newAggregate.op == op))
+				newAggregate.op = op;
+		}
+		ImGui::EndCombo();
+	}
+	if (newAggregate.op != AggregateOp::Count) {
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(LISTBOX_WIDTH);
+		if (newAggregate.column >= table.columns.size())
+			newAggregate.column = 0;
+		if (ImGui::BeginCombo("##aggregate_column", column_label(table.columns[newAggregate.column]).c_str())) {
+			for (ColId c = 0; c < (ColId)table.columns.size(); ++c) {
+				if (ImGui::Selectable(column_label(table.columns[c]).c_str(), newAggregate.column == c))
+					newAggregate.column = c;
+			}
+			ImGui::EndCombo();
+		}
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Add"))
+		g_group_spec.aggregates.push_back(newAggregate);
+	// Aggregates, a click removes them
+	for (std::size_t a = 0; a < g_group_spec.aggregates.size(); ++a) {
+		const Aggregate& aggregate = g_group_spec.aggregates[a];
+		std::string label = aggregate_op_name(aggregate.op);
+		if (aggregate.op != AggregateOp::Count)
+			label += "(" + (aggregate.column < table.columns.size() ? column_label(table.columns[aggregate.column]) : std::string("?")) + ")";
+		ImGui::PushID((int)a);
+		if (a > 0)
+			ImGui::SameLine();
+		if (ImGui::SmallButton((label + " x").c_str())) {
+			g_group_spec.aggregates.erase(g_group_spec.aggregates.begin() + a);
+			ImGui::PopID();
+			break;
+		}
+		ImGui::PopID();
+	}
+
+	// Only aggregates again if the spec, the filter result or the table changed
+	const bool grouped = g_groups.update(table, g_filter.rows, g_rows_generation, g_group_spec);
+	const SheetTable& result = g_groups.result;
+	if (result.columns.empty())
+		return;
+	if (grouped)
+		g_group_sort_keys.erase(std::remove_if(g_group_sort_keys.begin(), g_group_sort_keys.end(), [&](const SortKey& k) { return k.column >= result.columns.size(); }), g_group_sort_keys.end());
 
-	for (int r = 0; r < (int)projectInfo.project.activeFile.rowCount; ++r) {
-		if (RowMatchesFilter(r))
-			filteredRows.push_back(r);
+	ImGuiTableFlags flags =
+		ImGuiTableFlags_Borders |
+		ImGuiTableFlags_RowBg |
+		ImGuiTableFlags_Resizable |
+		ImGuiTableFlags_ScrollY |
+		ImGuiTableFlags_ScrollX |
+		ImGuiTableFlags_Sortable |
+		ImGuiTableFlags_SortMulti |
+		ImGuiTableFlags_SortTristate;
+	if (ImGui::BeginTable("##group_table", (int)result.columns.size(), flags)) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		for (const auto& col : result.columns) {
+			ImGui::TableSetupColumn(column_label(col).c_str(), ImGuiTableColumnFlags_WidthFixed, 140.0f, column_id(col));
+		}
+		ImGui::TableHeadersRow();
+		static std::vector<int> visibleColumns;
+		visible_columns((int)result.columns.size(), visibleColumns);
+		if (ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs(); specs && specs->SpecsDirty) {
+			g_group_sort_keys.clear();
+			for (int i = 0; i < specs->SpecsCount; ++i) {
+				g_group_sort_keys.push_back({ (ColId)specs->Specs[i].ColumnIndex, specs->Specs[i].SortDirection == ImGuiSortDirection_Descending });
+			}
+			specs->SpecsDirty = false;
+		}
+		g_group_sort.update(result, g_group_sort_keys);
+		// A new result can be shown before its order is ready, it is shown unsorted until then
+		const bool ordered = !g_group_sort_keys.empty() && g_group_sort.order.size() == result.rowCount;
+
+		ImGuiListClipper clipper;
+		clipper.Begin((int)result.rowCount);
+		while (clipper.Step()) {
+			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+				const int r = ordered ? g_group_sort.order[i] : i;
+				ImGui::TableNextRow();
+				for (const int c : visibleColumns) {
+					ImGui::TableSetColumnIndex(c);
+					ImGui::TextUnformatted(result.columns[c].values[r].second.c_str());
+				}
+			}
+		}
+		ImGui::EndTable();
 	}
 }
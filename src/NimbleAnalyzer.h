@@ -15,6 +15,8 @@ public:
 	void menubar();
 	void contentwindow();
 	void cleanup();
+	// True while background work (filter, sort, group by, index) is running
+	bool busy() const;
 private:
 	void dataView();
 	void justMerge();
@@ -28,7 +30,12 @@ private:
 	void sheetSelection();
 	void showHeaders();
 	void mergeSettings();
-	void filterRows();
+	void mergePreview();
+	void undoRedo();
+	// Returns true if the filtered rows changed
+	bool filterRows();
+	// Aggregates of the filtered rows below the data view
+	void groupByPanel();
 	
 	ViewMode viewmode = ViewMode::ProjectSelection;
 	struct {
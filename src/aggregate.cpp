@@ -0,0 +1,323 @@
+#include "aggregate.h"
+#include "redraw.h"
+#include "workerpool.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+
+const char* aggregate_op_name(AggregateOp op) {
+	switch (op) {
+	case AggregateOp::Count:
+		return "count";
+	case AggregateOp::Sum:
+		return "sum";
+	case AggregateOp::Min:
+		return "min";
+	case AggregateOp::Max:
+		return "max";
+	case AggregateOp::Mean:
+		return "mean";
+	case AggregateOp::DistinctCount:
+		return "distinct";
+	}
+	return "";
+}
+
+namespace {
+// Open addressing set of text hashes, node based sets miss the cache on nearly every insert
+struct HashSet {
+	std::vector<std::uint64_t> slots;	// 0 marks an empty slot
+	std::size_t count = 0;
+
+	void insert(std::uint64_t h) {
+		if (h == 0)
+			h = 1;
+		if ((count + 1) * 2 > slots.size())
+			grow();
+		const std::size_t mask = slots.size() - 1;
+		for (std::size_t i = (h ^ (h >> 29)) & mask;; i = (i + 1) & mask) {
+			if (slots[i] == h)
+				return;
+			if (slots[i] == 0) {
+				slots[i] = h;
+				count++;
+				return;
+			}
+		}
+	}
+	void grow() {
+		std::vector<std::uint64_t> old = std::move(slots);
+		slots.assign(std::max<std::size_t>(16, old.size() * 2), 0);
+		count = 0;
+		for (const std::uint64_t h : old) {
+			if (h)
+				insert(h);
+		}
+	}
+};
+
+// Running state of one aggregate of one group
+struct Accumulator {
+	std::uint64_t numbers = 0;	// numeric cells seen
+	double sum = 0.0;
+	double min = std::numeric_limits<double>::infinity();
+	double max = -std::numeric_limits<double>::infinity();
+	HashSet distinct;	// DistinctCount only, hashes of the texts
+};
+
+struct Group {
+	int first = 0;	// first row, also stands for the group key
+	std::uint64_t rows = 0;
+	std::vector<Accumulator> accumulators;
+};
+
+// A group key is found by the hash of its texts and compared through the first row of the group
+struct GroupRef {
+	std::uint64_t hash;
+	int row;
+};
+
+struct GroupHash {
+	std::size_t operator()(const GroupRef& g) const { return (std::size_t)g.hash; }
+};
+
+struct GroupEqual {
+	const std::vector<const Column*>* columns;
+	bool operator()(const GroupRef& a, const GroupRef& b) const {
+		if (a.hash != b.hash)
+			return false;
+		for (const Column* column : *columns) {
+			if (column->values[a.row].second != column->values[b.row].second)
+				return false;
+		}
+		return true;
+	}
+};
+
+// Groups of the rows one thread aggregated
+struct Partial {
+	std::unordered_map<GroupRef, std::uint32_t, GroupHash, GroupEqual> index;
+	std::vector<Group> groups;
+};
+}
+
+static std::uint64_t group_hash(const std::vector<const Column*>& columns, int row) {
+	std::uint64_t h = 0;
+	for (const Column* column : columns) {
+		h = (h ^ std::hash<std::string_view>{}(column->values[row].second)) * 0x9E3779B97F4A7C15ull;
+	}
+	return h ^ (h >> 32);
+}
+
+static bool numeric_value(const ExcelValue& v, double& out) {
+	if (const auto* i = std::get_if<std::int64_t>(&v))
+		out = (double)*i;
+	else if (const auto* d = std::get_if<double>(&v))
+		out = *d;
+	else
+		return false;
+	return true;
+}
+
+static Group new_group(const std::vector<Aggregate>& aggregates, int first) {
+	Group g;
+	g.first = first;
+	g.accumulators.resize(aggregates.size());
+	return g;
+}
+
+static void accumulate(Accumulator& acc, const Aggregate& aggregate, const std::pair<ExcelValue, std::string>& cell) {
+	if (aggregate.op == AggregateOp::DistinctCount) {
+		acc.distinct.insert(std::hash<std::string_view>{}(cell.second));
+		return;
+	}
+	double value;
+	if (!numeric_value(cell.first, value))
+		return;
+	acc.numbers++;
+	acc.sum += value;
+	acc.min = std::min(acc.min, value);
+	acc.max = std::max(acc.max, value);
+}
+
+static void merge_group(Group& into, Group& from) {
+	into.first = std::min(into.first, from.first);
+	into.rows += from.rows;
+	for (std::size_t a = 0; a < into.accumulators.size(); ++a) {
+		Accumulator& x = into.accumulators[a];
+		Accumulator& y = from.accumulators[a];
+		x.numbers += y.numbers;
+		x.sum += y.sum;
+		x.min = std::min(x.min, y.min);
+		x.max = std::max(x.max, y.max);
+		for (const std::uint64_t h : y.distinct.slots) {
+			if (h)
+				x.distinct.insert(h);
+		}
+	}
+}
+
+static std::pair<ExcelValue, std::string> aggregate_cell(const Aggregate& aggregate, const Group& group, std::size_t a) {
+	const Accumulator& acc = group.accumulators[a];
+	ExcelValue value;
+	switch (aggregate.op) {
+	case AggregateOp::Count:
+		value = (std::int64_t)group.rows;
+		break;
+	case AggregateOp::DistinctCount:
+		value = (std::int64_t)acc.distinct.count;
+		break;
+	case AggregateOp::Sum:
+		if (acc.numbers)
+			value = acc.sum;
+		break;
+	case AggregateOp::Min:
+		if (acc.numbers)
+			value = acc.min;
+		break;
+	case AggregateOp::Max:
+		if (acc.numbers)
+			value = acc.max;
+		break;
+	case AggregateOp::Mean:
+		if (acc.numbers)
+			value = acc.sum / (double)acc.numbers;
+		break;
+	}
+	std::string display = to_display(value);
+	return { std::move(value), std::move(display) };
+}
+
+static void add_column(SheetTable& table, std::string name) {
+	auto& ids = table.byName[name];
+	Column& column = table.columns.emplace_back();
+	column.key = { std::move(name), (std::uint32_t)ids.size() };
+	ids.push_back((ColId)table.columns.size() - 1);
+}
+
+SheetTable GroupBy(const SheetTable& table, const std::vector<int>& rows, const GroupBySpec& spec, const std::atomic<bool>* cancel) {
+	std::vector<const Column*> groupColumns;
+	for (const ColId c : spec.groups) {
+		if (c < table.columns.size())
+			groupColumns.push_back(&table.columns[c]);
+	}
+	std::vector<Aggregate> aggregates;
+	for (const Aggregate& a : spec.aggregates) {
+		if (a.op == AggregateOp::Count || a.column < table.columns.size())
+			aggregates.push_back(a);
+	}
+	std::vector<int> valid;
+	const std::vector<int>* input = &rows;
+	if (!rows.empty() && (std::size_t)rows.back() >= table.rowCount) {
+		valid.assign(rows.begin(), std::lower_bound(rows.begin(), rows.end(), (int)table.rowCount));
+		input = &valid;
+	}
+
+	// Every worker takes the next block of rows and aggregates it into its own partial groups
+	const std::size_t blocks = (input->size() + AGGREGATE_BLOCK_ROWS - 1) / AGGREGATE_BLOCK_ROWS;
+	const std::size_t threads = std::min(blocks, WorkerCount());
+	std::vector<Partial> partials;
+	for (std::size_t t = 0; t < threads; ++t) {
+		partials.push_back({ decltype(Partial::index)(0, GroupHash{}, GroupEqual{ &groupColumns }), {} });
+	}
+	std::atomic<std::size_t> next = 0;
+	ParallelFor(threads, [&](std::size_t t) {
+		Partial& partial = partials[t];
+		for (std::size_t b = next++; b < blocks; b = next++) {
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				return;
+			const std::size_t end = std::min(input->size(), (b + 1) * AGGREGATE_BLOCK_ROWS);
+			for (std::size_t i = b * AGGREGATE_BLOCK_ROWS; i < end; ++i) {
+				const int r = (*input)[i];
+				const auto [it, added] = partial.index.try_emplace({ group_hash(groupColumns, r), r }, (std::uint32_t)partial.groups.size());
+				if (added)
+					partial.groups.push_back(new_group(aggregates, r));
+				Group& group = partial.groups[it->second];
+				group.rows++;
+				for (std::size_t a = 0; a < aggregates.size(); ++a) {
+					if (aggregates[a].op != AggregateOp::Count)
+						accumulate(group.accumulators[a], aggregates[a], table.columns[aggregates[a].column].values[r]);
+				}
+			}
+		}
+		});
+	if (cancel && cancel->load(std::memory_order_relaxed))
+		return {};
+
+	// Partial groups of the same key are merged into the first partial that has it
+	std::unordered_map<GroupRef, std::uint32_t, GroupHash, GroupEqual> index(0, GroupHash{}, GroupEqual{ &groupColumns });
+	std::vector<Group> groups;
+	for (Partial& partial : partials) {
+		for (Group& group : partial.groups) {
+			const auto [it, added] = index.try_emplace({ group_hash(groupColumns, group.first), group.first }, (std::uint32_t)groups.size());
+			if (added)
+				groups.push_back(std::move(group));
+			else
+				merge_group(groups[it->second], group);
+		}
+		partial = {};
+	}
+	std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) { return a.first < b.first; });
+
+	SheetTable result;
+	result.name = table.name;
+	result.loaded = true;
+	result.rowCount = groups.size();
+	for (const Column* column : groupColumns) {
+		add_column(result, column->key.name);
+		for (const Group& group : groups) {
+			result.columns.back().values.push_back(column->values[group.first]);
+		}
+	}
+	for (std::size_t a = 0; a < aggregates.size(); ++a) {
+		const Aggregate& aggregate = aggregates[a];
+		std::string name = aggregate_op_name(aggregate.op);
+		if (aggregate.op != AggregateOp::Count)
+			name += "(" + header_label(table.columns[aggregate.column].key) + ")";
+		add_column(result, std::move(name));
+		for (const Group& group : groups) {
+			result.columns.back().values.push_back(aggregate_cell(aggregate, group, a));
+		}
+	}
+	return result;
+}
+
+bool GroupByCache::update(const SheetTable& table, const std::vector<int>& rows, std::uint64_t rowsGeneration, const GroupBySpec& spec) {
+	Input next{ spec, table.version, rowsGeneration };
+	if (generation == 0 || !(next == wanted)) {
+		wanted = std::move(next);
+		generation++;
+		// The running job is outdated now, stopping it instead of waiting for a result that gets dropped
+		if (job.valid()) {
+			cancel->store(true);
+			retired.add(std::move(job));
+			job = {};
+		}
+	}
+	retired.poll();
+	bool changed = false;
+	if (job.valid() && job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		result = job.get();
+		resultGeneration = jobGeneration;
+		changed = true;
+	}
+	// Up to date or still running
+	if (resultGeneration == generation || job.valid())
+		return changed;
+	if (rows.size() < AGGREGATE_ASYNC_ROWS) {
+		result = GroupBy(table, rows, spec);
+		resultGeneration = generation;
+		return true;
+	}
+	// The copy shares the column chunks, edits of the table after this do not reach the worker
+	jobGeneration = generation;
+	cancel = std::make_shared<std::atomic<bool>>(false);
+	job = std::async(std::launch::async, [table, rows, spec, stop = cancel]() {
+		SheetTable result = GroupBy(table, rows, spec, stop.get());
+		RequestRedraw();
+		return result;
+		});
+	return changed;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+#include "project.h"
+#include "retiredjobs.h"
+
+// Rows per block of the parallel aggregation
+constexpr std::size_t AGGREGATE_BLOCK_ROWS = 1 << 16;
+// At least this many rows are aggregated on a worker thread
+constexpr std::size_t AGGREGATE_ASYNC_ROWS = 50000;
+
+enum class AggregateOp {
+	Count,	// rows of the group, ignores the column
+	Sum,
+	Min,
+	Max,
+	Mean,
+	DistinctCount	// different texts of the column
+};
+const char* aggregate_op_name(AggregateOp op);
+
+struct Aggregate {
+	AggregateOp op = AggregateOp::Count;
+	ColId column = 0;
+	bool operator==(const Aggregate&) const = default;
+};
+
+struct GroupBySpec {
+	std::vector<ColId> groups;	// rows with the same texts in these columns form a group, none puts all rows in one group
+	std::vector<Aggregate> aggregates;
+	bool operator==(const GroupBySpec&) const = default;
+};
+
+// One row per group with the group columns followed by one column per aggregate, e.g. 'sum(Result)'.
+// Sum, Min, Max and Mean only look at numeric cells and stay empty without any.
+// Groups are in the order of their first row. Only rows (ascending, e.g. a filter result) are aggregated,
+// in blocks on several threads that merge their partial groups at the end. Returns an empty table once cancel is set.
+SheetTable GroupBy(const SheetTable& table, const std::vector<int>& rows, const GroupBySpec& spec, const std::atomic<bool>* cancel = nullptr);
+
+// Group by result that is kept between frames, only computed again if the spec, the rows or the table version changed
+struct GroupByCache {
+	SheetTable result;
+	std::uint64_t generation = 0;	// counts the changes of the input
+
+	// rowsGeneration has to change whenever rows changes. Returns true if result changed.
+	// Large inputs are aggregated on a worker thread over copies, result keeps the old groups until it is done.
+	bool update(const SheetTable& table, const std::vector<int>& rows, std::uint64_t rowsGeneration, const GroupBySpec& spec);
+	bool pending() const { return job.valid(); }
+
+private:
+	struct Input {
+		GroupBySpec spec;
+		std::uint64_t version = 0;
+		std::uint64_t rowsGeneration = 0;
+		bool operator==(const Input&) const = default;
+	};
+	Input wanted;
+	std::uint64_t resultGeneration = 0;	// generation result was computed for
+	std::uint64_t jobGeneration = 0;
+	std::future<SheetTable> job;
+	std::shared_ptr<std::atomic<bool>> cancel;	// stops job
+	RetiredJobs<SheetTable> retired;	// cancelled jobs that did not stop yet
+};
@@ -7,7 +7,9 @@
 #include <tinyxml2.h>
 #include <filesystem>
 #include <fstream>
+#include <chrono>
 #include <raylib.h>
+#include "redraw.h"
 #include "ressourcemanager.h"
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -23,6 +25,12 @@ using namespace tinyxml2;
 #define WINDOW_SETTINGS_FILE "window.bin"
 #define LOG_WINDOW_HEIGHT 400.0f
 #define TEXT_INPUT_WIDTH 400.0f
+// Frames keep being drawn this long after input so hover, click and tooltip delays settle
+#define ACTIVE_REDRAW_SECONDS 0.5
+// Input is polled this often while idle
+#define IDLE_POLL_MS 10
+// Frames while background work is running, picks up its results if the wake up came too early
+#define BUSY_REDRAW_SECONDS 0.1
 
 void App::init(const char* name){
 	createDirs();
@@ -34,10 +42,17 @@ void App::init(const char* name){
 }
 
 void App::run() {
-	// Main loop
+	// Main loop, the first frames are always drawn
+	m_redraw.activeUntil = GetTime() + ACTIVE_REDRAW_SECONDS;
 	while (!WindowShouldClose()) {
+		if (m_redraw.enabled && !waitForActivity())
+			continue;
 		render();
 		handleDropfiles();
+		// Active widgets (text input, dragging) keep drawing, everything else goes idle after a while
+		m_redraw.lastFrame = GetTime();
+		if (ImGui::IsAnyItemActive())
+			m_redraw.activeUntil = m_redraw.lastFrame + ACTIVE_REDRAW_SECONDS;
 	}
 	cleanup();
 }
@@ -161,6 +176,37 @@ void App::saveSettings() {
 	logging::loginfo("[App::saveSettings] Windowsettings saved!");
 }
 
+// True if the last PollInputEvents saw any input, none of it is consumed
+static bool input_activity() {
+	const Vector2 delta = GetMouseDelta();
+	if (delta.x != 0.0f || delta.y != 0.0f || GetMouseWheelMove() != 0.0f)
+		return true;
+	for (int button = MOUSE_BUTTON_LEFT; button <= MOUSE_BUTTON_BACK; button++) {
+		if (IsMouseButtonPressed(button) || IsMouseButtonReleased(button))
+			return true;
+	}
+	for (int key = KEY_SPACE; key <= KEY_KB_MENU; key++) {
+		if (IsKeyPressed(key) || IsKeyReleased(key))
+			return true;
+	}
+	return IsWindowResized() || IsFileDropped();
+}
+
+bool App::waitForActivity(){
+	if (GetTime() < m_redraw.activeUntil)
+		return true;
+	// Nothing is drawn while idle, EndDrawing does not poll the input then
+	const bool requested = WaitForRedraw(std::chrono::milliseconds(IDLE_POLL_MS));
+	PollInputEvents();
+	const bool focused = IsWindowFocused();
+	if (requested || input_activity() || focused != m_redraw.focused) {
+		m_redraw.focused = focused;
+		m_redraw.activeUntil = GetTime() + ACTIVE_REDRAW_SECONDS;
+		return true;
+	}
+	return na.busy() && GetTime() - m_redraw.lastFrame >= BUSY_REDRAW_SECONDS;
+}
+
 void App::render(){
 	BeginDrawing();
 	//ClearBackground(BLACK);
@@ -294,6 +340,8 @@ void App::taskbar(){
 		ImGui::EndMenu();
 	}
 	ImGui::Checkbox("Log window", &m_logviewSettings.displaylog);
+	ImGui::Checkbox("Save CPU", &m_redraw.enabled);
+	ImGui::SetItemTooltip("Only redraws after input, finished background work or new log messages");
 	ImGui::EndMainMenuBar();
 }
 
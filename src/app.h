@@ -18,6 +18,8 @@ private:
 	void loadDefaults();
 	// Logic functions
 	void render();
+	// Blocks while nothing happens, returns false if the next frame can be skipped
+	bool waitForActivity();
 	void handleDropfiles();
 	// Shutdown functions
 	void saveSettings();
@@ -33,6 +35,14 @@ private:
 
 	// NimbleAnalyzer
 	NimbleAnalyzer na;
+
+	// Drawing on demand instead of every frame
+	struct {
+		bool enabled = true;
+		double activeUntil = 0.0;	// GetTime() until frames are drawn after the last activity
+		double lastFrame = 0.0;
+		bool focused = true;
+	} m_redraw;
 	
 	// window settings
 	struct {
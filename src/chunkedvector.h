@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Vector stored in fixed size chunks that are shared between copies (copy on write).
+// Copying is O(1), the first write to a shared chunk copies only that chunk.
+// Reading is only possible through const access, writing goes through edit() so nothing gets copied by accident.
+template <typename T>
+class ChunkedVector {
+public:
+	static constexpr std::size_t CHUNK_SIZE = 4096;
+	using Chunk = std::vector<T>;
+	using value_type = T;
+
+	class const_iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T*;
+		using reference = const T&;
+
+		const_iterator() = default;
+		const_iterator(const ChunkedVector* v, std::size_t i) : vec(v), index(i) {}
+		const T& operator*() const { return (*vec)[index]; }
+		const T* operator->() const { return &(*vec)[index]; }
+		const_iterator& operator++() { ++index; return *this; }
+		const_iterator operator++(int) { const_iterator tmp = *this; ++index; return tmp; }
+		bool operator==(const const_iterator& o) const { return index == o.index; }
+	private:
+		const ChunkedVector* vec = nullptr;
+		std::size_t index = 0;
+	};
+
+	std::size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T& operator[](std::size_t i) const { return (*(*chunks)[i / CHUNK_SIZE])[i % CHUNK_SIZE]; }
+	const T& back() const { return (*this)[count - 1]; }
+	const_iterator begin() const { return { this, 0 }; }
+	const_iterator end() const { return { this, count }; }
+
+	// Writable element, copies its chunk first if another copy still uses it
+	T& edit(std::size_t i) { return writable_chunk(i / CHUNK_SIZE)[i % CHUNK_SIZE]; }
+
+	template <typename... Args>
+	T& emplace_back(Args&&... args) {
+		open_space();
+		T& value = writable_chunk(count / CHUNK_SIZE).emplace_back(std::forward<Args>(args)...);
+		++count;
+		return value;
+	}
+	void push_back(T value) { emplace_back(std::move(value)); }
+	void pop_back() {
+		writable_chunk((count - 1) / CHUNK_SIZE).pop_back();
+		--count;
+		if (count % CHUNK_SIZE == 0)
+			list().pop_back();
+	}
+	// Appends [first, last) one chunk at a time, It has to be random access
+	template <typename It>
+	void append(It first, It last) {
+		std::size_t n = std::distance(first, last);
+		while (n > 0) {
+			const std::size_t k = std::min(n, open_space());
+			Chunk& chunk = writable_chunk(count / CHUNK_SIZE);
+			chunk.insert(chunk.end(), first, first + k);
+			first += k;
+			count += k;
+			n -= k;
+		}
+	}
+	// Appends all of other. If this ends on a chunk boundary the chunks of other are shared instead of copied.
+	void append(const ChunkedVector& other) {
+		if (other.empty())
+			return;
+		if (count % CHUNK_SIZE == 0) {
+			const std::vector<std::shared_ptr<Chunk>> shared = *other.chunks;	// other might be this
+			auto& l = list();
+			l.insert(l.end(), shared.begin(), shared.end());
+			count += other.count;
+			return;
+		}
+		const std::size_t chunkCount = other.chunk_count();
+		for (std::size_t c = 0; c < chunkCount; c++) {
+			const std::shared_ptr<Chunk> chunk = (*other.chunks)[c];
+			append(chunk->begin(), chunk->end());
+		}
+	}
+	// Appends n copies of value, all full chunks in between share a single chunk
+	void append_fill(std::size_t n, const T& value) {
+		if (n > 0 && count % CHUNK_SIZE != 0) {
+			const std::size_t k = std::min(n, open_space());
+			Chunk& chunk = writable_chunk(count / CHUNK_SIZE);
+			chunk.insert(chunk.end(), k, value);
+			count += k;
+			n -= k;
+		}
+		if (n >= CHUNK_SIZE) {
+			const auto full = std::make_shared<Chunk>(CHUNK_SIZE, value);
+			auto& l = list();
+			for (; n >= CHUNK_SIZE; n -= CHUNK_SIZE) {
+				l.push_back(full);
+				count += CHUNK_SIZE;
+			}
+		}
+		if (n > 0) {
+			open_space();
+			Chunk& chunk = writable_chunk(count / CHUNK_SIZE);
+			chunk.insert(chunk.end(), n, value);
+			count += n;
+		}
+	}
+	// Drops every element from n on
+	void truncate(std::size_t n) {
+		if (n >= count)
+			return;
+		auto& l = list();
+		l.resize((n + CHUNK_SIZE - 1) / CHUNK_SIZE);
+		if (n % CHUNK_SIZE != 0) {
+			Chunk& chunk = writable_chunk(l.size() - 1);
+			chunk.erase(chunk.begin() + n % CHUNK_SIZE, chunk.end());
+		}
+		count = n;
+	}
+	void clear() {
+		chunks.reset();
+		count = 0;
+	}
+
+	// Storage inspection, used to tell which chunks two copies still share
+	std::size_t chunk_count() const { return chunks ? chunks->size() : 0; }
+	const Chunk* chunk(std::size_t c) const { return (*chunks)[c].get(); }
+	// True if both use the same chunk list. A copy that is kept around stays the same until one of them changes.
+	bool shares_storage(const ChunkedVector& other) const { return chunks == other.chunks; }
+	// Shares chunk c, while it is held the next edit of it copies the chunk
+	std::shared_ptr<const Chunk> shared_chunk(std::size_t c) const { return (*chunks)[c]; }
+
+private:
+	// Free slots in the last chunk, starts a new chunk if the last one is full
+	std::size_t open_space() {
+		if (count % CHUNK_SIZE == 0) {
+			list().push_back(std::make_shared<Chunk>());
+			list().back()->reserve(CHUNK_SIZE);
+			return CHUNK_SIZE;
+		}
+		return CHUNK_SIZE - count % CHUNK_SIZE;
+	}
+	std::vector<std::shared_ptr<Chunk>>& list() {
+		if (!chunks)
+			chunks = std::make_shared<std::vector<std::shared_ptr<Chunk>>>();
+		else if (chunks.use_count() > 1)
+			chunks = std::make_shared<std::vector<std::shared_ptr<Chunk>>>(*chunks);
+		return *chunks;
+	}
+	Chunk& writable_chunk(std::size_t c) {
+		auto& l = list();
+		if (l[c].use_count() > 1) {
+			auto copy = std::make_shared<Chunk>();
+			copy->reserve(CHUNK_SIZE);
+			copy->assign(l[c]->begin(), l[c]->end());
+			l[c] = std::move(copy);
+		}
+		return *l[c];
+	}
+
+	std::shared_ptr<std::vector<std::shared_ptr<Chunk>>> chunks;
+	std::size_t count = 0;
+};
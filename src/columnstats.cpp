@@ -0,0 +1,103 @@
+#include "columnstats.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <string_view>
+#include <unordered_map>
+
+static std::uint64_t mix64(std::uint64_t x) {
+	// splitmix64 finalizer, std::hash of some standard libraries has weak high bits
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+void StatsSummary::merge(const StatsSummary& other) {
+	rows += other.rows;
+	empty += other.empty;
+	numbers += other.numbers;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+	sum += other.sum;
+	for (std::size_t i = 0; i < STATS_HLL_REGISTERS; ++i) {
+		registers[i] = std::max(registers[i], other.registers[i]);
+	}
+}
+
+std::size_t StatsSummary::distinct() const {
+	constexpr double m = (double)STATS_HLL_REGISTERS;
+	double inverse = 0.0;
+	std::size_t zeros = 0;
+	for (const std::uint8_t r : registers) {
+		inverse += std::ldexp(1.0, -r);
+		zeros += r == 0;
+	}
+	const double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / inverse;
+	// Linear counting is more exact while many registers are still empty
+	if (estimate <= 2.5 * m && zeros > 0)
+		return (std::size_t)std::llround(m * std::log(m / (double)zeros));
+	return (std::size_t)std::llround(estimate);
+}
+
+StatsSummary SummarizeCells(const decltype(Column::values)::Chunk& cells) {
+	StatsSummary s;
+	s.rows = cells.size();
+	for (const auto& [value, text] : cells) {
+		double number = 0.0;
+		bool isNumber = true;
+		if (const auto* i = std::get_if<std::int64_t>(&value))
+			number = (double)*i;
+		else if (const auto* d = std::get_if<double>(&value))
+			number = *d;
+		else if (text.empty()) {
+			s.empty++;
+			continue;
+		}
+		else
+			isNumber = false;
+		if (isNumber) {
+			s.numbers++;
+			s.sum += number;
+			s.min = std::min(s.min, number);
+			s.max = std::max(s.max, number);
+		}
+		// The top bits pick the register, it keeps the longest run of leading zeros of the rest
+		const std::uint64_t h = mix64(std::hash<std::string_view>{}(text));
+		const std::size_t index = h >> (64 - STATS_HLL_BITS);
+		const std::uint8_t rank = (std::uint8_t)std::countl_zero((h << STATS_HLL_BITS) | (std::uint64_t(1) << (STATS_HLL_BITS - 1))) + 1;
+		s.registers[index] = std::max(s.registers[index], rank);
+	}
+	return s;
+}
+
+const StatsSummary& GetColumnStats(const Column& column) {
+	const auto& values = column.values;
+	const ColumnStats* cached = column.stats.get();
+	bool current = cached && cached->chunks.size() == values.chunk_count();
+	for (std::size_t c = 0; current && c < values.chunk_count(); ++c) {
+		current = cached->chunks[c]->chunk.get() == values.chunk(c);
+	}
+	if (current)
+		return cached->summary;
+	// Statistics of the last call by chunk, a chunk that did not change keeps them
+	std::unordered_map<const decltype(Column::values)::Chunk*, std::shared_ptr<const ChunkStats>> known;
+	if (cached) {
+		for (const auto& chunk : cached->chunks) {
+			known.emplace(chunk->chunk.get(), chunk);
+		}
+	}
+	auto stats = std::make_shared<ColumnStats>();
+	stats->chunks.reserve(values.chunk_count());
+	for (std::size_t c = 0; c < values.chunk_count(); ++c) {
+		auto& chunk = known[values.chunk(c)];
+		if (!chunk)
+			chunk = std::make_shared<const ChunkStats>(ChunkStats{ values.shared_chunk(c), SummarizeCells(*values.chunk(c)) });
+		stats->summary.merge(chunk->summary);
+		stats->chunks.push_back(chunk);
+	}
+	column.stats = std::move(stats);
+	return column.stats->summary;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "project.h"
+
+// HyperLogLog registers per summary, 2^12 gives distinct estimates within about 1.6%
+constexpr int STATS_HLL_BITS = 12;
+constexpr std::size_t STATS_HLL_REGISTERS = std::size_t(1) << STATS_HLL_BITS;
+
+// Statistics of a run of cells. Summaries of different runs merge into the summary of both.
+struct StatsSummary {
+	std::size_t rows = 0;
+	std::size_t empty = 0;	// cells without a value
+	std::size_t numbers = 0;	// numeric cells, min, max and sum only look at these
+	double min = std::numeric_limits<double>::infinity();
+	double max = -std::numeric_limits<double>::infinity();
+	double sum = 0.0;
+	std::array<std::uint8_t, STATS_HLL_REGISTERS> registers{};	// HyperLogLog sketch of the texts of non empty cells
+
+	void merge(const StatsSummary& other);
+	double mean() const { return numbers ? sum / (double)numbers : 0.0; }
+	// Estimated number of different non empty texts
+	std::size_t distinct() const;
+};
+
+// Statistics of one chunk, the chunk is held so an edit of it copies it and the next lookup notices
+struct ChunkStats {
+	std::shared_ptr<const decltype(Column::values)::Chunk> chunk;
+	StatsSummary summary;
+};
+
+struct ColumnStats {
+	StatsSummary summary;
+	std::vector<std::shared_ptr<const ChunkStats>> chunks;
+};
+
+StatsSummary SummarizeCells(const decltype(Column::values)::Chunk& cells);
+
+// Statistics of column, computed on first use and cached on the column.
+// Appends and edits since the last call only recount the chunks they changed. Not thread safe.
+const StatsSummary& GetColumnStats(const Column& column);
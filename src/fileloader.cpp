@@ -185,6 +185,41 @@ std::string fileloader::GetLastWriteTime(const std::string& path){
 	return ss.str();
 }
 
+std::int64_t fileloader::GetLastWriteTicks(const std::string& path){
+	std::error_code ec;
+	auto ftime = fs::last_write_time(u8topath(path), ec);
+	if (ec)
+		return 0;
+	return static_cast<std::int64_t>(ftime.time_since_epoch().count());
+}
+
+std::uintmax_t fileloader::filesize(const std::string& path){
+	std::error_code ec;
+	std::uintmax_t size = fs::file_size(u8topath(path), ec);
+	if (ec)
+		return 0;
+	return size;
+}
+
+std::uint64_t fileloader::hashfile(const std::string& path){
+	std::uint64_t hash = 14695981039346656037ull;
+	std::ifstream file(u8topath(path), std::ios::binary);
+	if (!file) {
+		logging::logwarning("[fileloader::hashfile] file could not be opened: %s", path.c_str());
+		return 0;
+	}
+	std::vector<char> buffer(1 << 16);
+	while (file) {
+		file.read(buffer.data(), buffer.size());
+		const std::streamsize n = file.gcount();
+		for (std::streamsize i = 0; i < n; i++) {
+			hash ^= static_cast<unsigned char>(buffer[i]);
+			hash *= 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
 std::string fileloader::GetCurrentPath(){
 	return fs::u8path(fs::current_path().string()).string();
 }
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <cstdint>
 
 namespace fileloader {
 	std::vector<std::string> loadfilelines(const std::string& filename, bool printinfo = true);
@@ -20,6 +21,10 @@ namespace fileloader {
 	std::string u8path(const std::string& path);
 	std::string u8topath(const std::string& path);
 	std::string GetLastWriteTime(const std::string& path);
+	std::int64_t GetLastWriteTicks(const std::string& path);
+	std::uintmax_t filesize(const std::string& path);
+	// FNV-1a hash over the whole file content
+	std::uint64_t hashfile(const std::string& path);
 	std::string GetCurrentPath();
 
 	void copy(const std::string& source, const std::string& dest, bool overwrite=true);
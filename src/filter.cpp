@@ -0,0 +1,690 @@
+#include "filter.h"
+#include "redraw.h"
+#include "utils.h"
+#include "workerpool.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <utility>
+
+static bool parse_number(const std::string& s, double& value) {
+	const auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+	return result.ec == std::errc() && result.ptr == s.data() + s.size();
+}
+
+// Query language, see CompileFilter
+struct QueryToken {
+	enum class Kind {
+		Word,
+		Quoted,
+		Operator,
+		Open,
+		Close,
+		End
+	};
+	Kind kind;
+	std::string text;
+};
+
+static bool is_operator_char(char c) {
+	return c == '<' || c == '>' || c == '=' || c == '!' || c == '%' || c == '^';
+}
+
+static bool tokenize_query(const std::string& s, std::vector<QueryToken>& tokens) {
+	using Kind = QueryToken::Kind;
+	std::size_t i = 0;
+	while (i < s.size()) {
+		const char c = s[i];
+		if (c == ' ' || c == '\t') {
+			++i;
+		}
+		else if (c == '(' || c == ')') {
+			tokens.push_back({ c == '(' ? Kind::Open : Kind::Close, std::string(1, c) });
+			++i;
+		}
+		else if (c == '"') {
+			const std::size_t close = s.find('"', i + 1);
+			if (close == std::string::npos)
+				return false;
+			tokens.push_back({ Kind::Quoted, s.substr(i + 1, close - i - 1) });
+			i = close + 1;
+		}
+		else if (is_operator_char(c)) {
+			std::string op(1, c);
+			++i;
+			// Two character operators: <= >= != !%
+			if (i < s.size() && ((s[i] == '=' && (c == '<' || c == '>' || c == '!')) || (c == '!' && s[i] == '%')))
+				op += s[i++];
+			tokens.push_back({ Kind::Operator, op });
+		}
+		else {
+			const std::size_t start = i;
+			while (i < s.size() && s[i] != ' ' && s[i] != '\t' && s[i] != '(' && s[i] != ')' && s[i] != '"' && !is_operator_char(s[i])) {
+				++i;
+			}
+			tokens.push_back({ Kind::Word, s.substr(start, i - start) });
+		}
+	}
+	tokens.push_back({ Kind::End, "" });
+	return true;
+}
+
+static int clause_cost(const FilterPredicate& p) {
+	using Op = FilterPredicate::Op;
+	switch (p.op) {
+	case Op::Equal:
+		return p.hasNumber ? 1 : 2;
+	case Op::Less:
+	case Op::LessEqual:
+	case Op::Greater:
+	case Op::GreaterEqual:
+		return 3;
+	case Op::Prefix:
+		return 4;
+	case Op::Contains:
+		return 5;
+	case Op::NotEqual:
+		return 6;
+	default:
+		return 7;
+	}
+}
+
+// Recursive descent: or := and (OR and)*, and := unary (AND unary)*, unary := NOT unary | ( or ) | clause
+struct QueryParser {
+	const SheetTable& table;
+	std::vector<QueryToken> tokens{};
+	std::size_t pos = 0;
+
+	const QueryToken& peek() const { return tokens[pos]; }
+	bool keyword(const char* word) const {
+		const QueryToken& t = tokens[pos];
+		if (t.kind != QueryToken::Kind::Word || t.text.size() != std::strlen(word))
+			return false;
+		for (std::size_t i = 0; i < t.text.size(); ++i) {
+			if (std::toupper((unsigned char)t.text[i]) != word[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool parse_list(FilterNode& node, FilterNode::Kind kind, const char* separator) {
+		std::vector<FilterNode> children(1);
+		if (!(kind == FilterNode::Kind::Or ? parse_list(children[0], FilterNode::Kind::And, "AND") : parse_unary(children[0])))
+			return false;
+		while (keyword(separator)) {
+			++pos;
+			children.emplace_back();
+			if (!(kind == FilterNode::Kind::Or ? parse_list(children.back(), FilterNode::Kind::And, "AND") : parse_unary(children.back())))
+				return false;
+		}
+		if (children.size() == 1) {
+			node = std::move(children[0]);
+			return true;
+		}
+		std::stable_sort(children.begin(), children.end(), [](const FilterNode& a, const FilterNode& b) { return a.cost < b.cost; });
+		node.kind = kind;
+		// AND is as cheap as its first clause, OR has to run all of them
+		node.cost = kind == FilterNode::Kind::And ? children.front().cost : children.back().cost;
+		node.children = std::move(children);
+		return true;
+	}
+
+	bool parse_unary(FilterNode& node) {
+		if (keyword("NOT")) {
+			++pos;
+			node.kind = FilterNode::Kind::Not;
+			node.children.resize(1);
+			if (!parse_unary(node.children[0]))
+				return false;
+			node.cost = node.children[0].cost;
+			return true;
+		}
+		if (peek().kind == QueryToken::Kind::Open) {
+			++pos;
+			if (!parse_list(node, FilterNode::Kind::Or, "OR") || peek().kind != QueryToken::Kind::Close)
+				return false;
+			++pos;
+			return true;
+		}
+		return parse_clause(node);
+	}
+
+	bool parse_clause(FilterNode& node) {
+		using Op = FilterPredicate::Op;
+		using Kind = QueryToken::Kind;
+		if (peek().kind != Kind::Word && peek().kind != Kind::Quoted)
+			return false;
+		const std::string& name = tokens[pos++].text;
+		if (peek().kind != Kind::Operator)
+			return false;
+		const std::string& op = tokens[pos++].text;
+		if (peek().kind != Kind::Word && peek().kind != Kind::Quoted)
+			return false;
+		const std::string& value = tokens[pos++].text;
+
+		FilterPredicate& p = node.clause;
+		for (ColId c = 0; c < (ColId)table.columns.size() && p.columns.empty(); ++c) {
+			if (column_label(table.columns[c]) == name)
+				p.columns.push_back(c);
+		}
+		if (p.columns.empty())
+			return false;
+		p.text = value;
+		double number = 0.0;
+		const bool isNumber = parse_number(normalize_decimal(value), number);
+		if (op == "=" || op == "!=") {
+			p.op = op == "=" ? Op::Equal : Op::NotEqual;
+			p.hasNumber = isNumber;
+			p.min = number;
+		}
+		else if (op == "%")
+			p.op = Op::Contains;
+		else if (op == "!%")
+			p.op = Op::NotContains;
+		else if (op == "^")
+			p.op = Op::Prefix;
+		else if (isNumber && (op == "<" || op == "<=")) {
+			p.op = op == "<" ? Op::Less : Op::LessEqual;
+			p.max = number;
+		}
+		else if (isNumber && (op == ">" || op == ">=")) {
+			p.op = op == ">" ? Op::Greater : Op::GreaterEqual;
+			p.min = number;
+		}
+		else
+			return false;
+		node.kind = FilterNode::Kind::Clause;
+		node.cost = clause_cost(p);
+		return true;
+	}
+};
+
+// Compiles search as a query, false if it is none (the plain search syntax is used then)
+static bool compile_query(const SheetTable& table, const std::string& search, FilterNode& plan) {
+	QueryParser parser{ table };
+	if (!tokenize_query(search, parser.tokens))
+		return false;
+	return parser.parse_list(plan, FilterNode::Kind::Or, "OR") && parser.peek().kind == QueryToken::Kind::End;
+}
+
+FilterPredicate CompileFilter(const SheetTable& table, const std::string& search, const std::string& header) {
+	FilterPredicate p;
+	if (search.empty())
+		return p;
+	FilterNode plan;
+	if (compile_query(table, search, plan)) {
+		p.op = FilterPredicate::Op::Query;
+		p.query = std::make_shared<FilterNode>(std::move(plan));
+		return p;
+	}
+	for (ColId c = 0; c < (ColId)table.columns.size(); ++c) {
+		if (header.empty() || header == column_label(table.columns[c]))
+			p.columns.push_back(c);
+	}
+	if (search.starts_with("<") && search.ends_with(">")) {
+		std::string s = normalize_decimal(search);
+		s = s.substr(1, s.size() - 2);
+		const auto [first, second] = Splitlines(s, ";");
+		p.op = FilterPredicate::Op::Range;
+		if (!parse_number(first, p.min) || !parse_number(second, p.max))
+			p.op = FilterPredicate::Op::None;
+	}
+	else if (search.starts_with("<")) {
+		p.op = parse_number(normalize_decimal(search).substr(1), p.max) ? FilterPredicate::Op::Less : FilterPredicate::Op::None;
+	}
+	else if (search.starts_with(">")) {
+		p.op = parse_number(normalize_decimal(search).substr(1), p.min) ? FilterPredicate::Op::Greater : FilterPredicate::Op::None;
+	}
+	else if (search.starts_with("!")) {
+		p.op = FilterPredicate::Op::NotContains;
+		p.text = search.substr(1);
+	}
+	else if (search.starts_with("%")) {
+		p.op = FilterPredicate::Op::Contains;
+		p.text = search.substr(1);
+	}
+	else {
+		p.op = FilterPredicate::Op::Prefix;
+		p.text = search;
+	}
+	if (p.columns.empty())
+		p.op = FilterPredicate::Op::None;
+	return p;
+}
+
+bool FilterPredicate::refines(const FilterPredicate& previous) const {
+	if (columns != previous.columns || op == Op::All || previous.op == Op::All || op == Op::Query || previous.op == Op::Query)
+		return false;
+	if (op == Op::None)
+		return true;
+	switch (previous.op) {
+	case Op::Prefix:
+		return op == Op::Prefix && text.starts_with(previous.text);
+	case Op::Contains:
+		return (op == Op::Contains || op == Op::Prefix) && text.contains(previous.text);
+	case Op::NotContains:
+		// Not containing a part of the old text means not containing the old text either
+		return op == Op::NotContains && previous.text.contains(text);
+	case Op::Range:
+		return op == Op::Range && min >= previous.min && max <= previous.max;
+	case Op::Less:
+		return (op == Op::Less || op == Op::Range) && max <= previous.max;
+	case Op::Greater:
+		return (op == Op::Greater || op == Op::Range) && min >= previous.min;
+	default:
+		return false;
+	}
+}
+
+static bool cell_matches(const FilterPredicate& p, const std::pair<ExcelValue, std::string>& cell) {
+	using Op = FilterPredicate::Op;
+	if (p.numeric()) {
+		double value;
+		if (const auto* i = std::get_if<std::int64_t>(&cell.first))
+			value = (double)*i;
+		else if (const auto* d = std::get_if<double>(&cell.first))
+			value = *d;
+		else
+			return false;
+		switch (p.op) {
+		case Op::Range:
+			return value > p.min && value < p.max;
+		case Op::Less:
+			return value < p.max;
+		case Op::LessEqual:
+			return value <= p.max;
+		case Op::GreaterEqual:
+			return value >= p.min;
+		default:
+			return value > p.min;
+		}
+	}
+	if (p.op == Op::Equal || p.op == Op::NotEqual) {
+		bool equal = cell.second == p.text;
+		if (p.hasNumber) {
+			if (const auto* i = std::get_if<std::int64_t>(&cell.first))
+				equal = (double)*i == p.min;
+			else if (const auto* d = std::get_if<double>(&cell.first))
+				equal = *d == p.min;
+		}
+		return equal == (p.op == Op::Equal);
+	}
+	if (p.op == Op::Prefix)
+		return cell.second.starts_with(p.text);
+	return cell.second.find(p.text) != std::string::npos;
+}
+
+// Matches of rows [begin, end), a row matches if any searched column matches (for NotContains if none contains the text).
+// Returns false if it was cancelled.
+static bool match_block(const SheetTable& table, const FilterPredicate& p, std::size_t begin, std::size_t end, std::vector<int>& out, const std::atomic<bool>* cancel) {
+	using Op = FilterPredicate::Op;
+	if (p.op == Op::None)
+		return true;
+	if (p.op == Op::All) {
+		for (std::size_t r = begin; r < end; ++r) {
+			out.push_back((int)r);
+		}
+		return true;
+	}
+	const bool negate = p.op == Op::NotContains;
+	std::vector<std::uint8_t> flags(end - begin, negate ? 1 : 0);
+	std::vector<std::uint16_t> candidates;
+	const bool packed = p.packedSearch();
+	const std::string needle = p.op == Op::Prefix ? '\0' + p.text : p.text;
+	constexpr std::size_t CHUNK_SIZE = decltype(Column::values)::CHUNK_SIZE;
+	for (ColId c : p.columns) {
+		const auto& values = table.columns[c].values;
+		const std::size_t last = std::min(end, values.size());
+		// Walking the chunks directly, one chunk is a contiguous array
+		for (std::size_t r = begin; r < last;) {
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				return false;
+			const auto& chunk = *values.chunk(r / CHUNK_SIZE);
+			const std::size_t stop = std::min(last, (r / CHUNK_SIZE + 1) * CHUNK_SIZE);
+			// Indexed chunks only check the rows that contain all trigrams of the text
+			const TrigramIndex::ChunkEntry* entry = p.indexed() ? p.index->entry(table, c, r / CHUNK_SIZE) : nullptr;
+			if (entry) {
+				const std::size_t base = r / CHUNK_SIZE * CHUNK_SIZE;
+				TrigramCandidates(*entry, p.text, candidates);
+				for (const std::uint16_t k : candidates) {
+					const std::size_t row = base + k;
+					if (row < r || row >= stop || flags[row - begin])
+						continue;
+					if (cell_matches(p, chunk[k]))
+						flags[row - begin] = 1;
+				}
+				r = stop;
+				continue;
+			}
+			// Otherwise one pass over the packed bytes of the chunk
+			if (packed) {
+				const std::size_t base = r / CHUNK_SIZE * CHUNK_SIZE;
+				PackedFind(*p.packed->get(values, r / CHUNK_SIZE), needle, candidates);
+				for (const std::uint16_t k : candidates) {
+					const std::size_t row = base + k;
+					if (row >= r && row < stop)
+						flags[row - begin] = !negate;
+				}
+				r = stop;
+				continue;
+			}
+			for (; r < stop; ++r) {
+				std::uint8_t& flag = flags[r - begin];
+				if (flag != negate)
+					continue;	// already decided by an earlier column
+				if (cell_matches(p, chunk[r % CHUNK_SIZE]))
+					flag = !negate;
+			}
+		}
+	}
+	for (std::size_t k = 0; k < flags.size(); ++k) {
+		if (flags[k])
+			out.push_back((int)(begin + k));
+	}
+	return true;
+}
+
+// Matches among the candidate rows [first, last), one row at a time as the candidates are scattered
+static bool match_rows(const SheetTable& table, const FilterPredicate& p, const int* first, const int* last, std::vector<int>& out, const std::atomic<bool>* cancel) {
+	using Op = FilterPredicate::Op;
+	if (p.op == Op::None)
+		return true;
+	const bool negate = p.op == Op::NotContains;
+	constexpr std::size_t CANCEL_CHECK = decltype(Column::values)::CHUNK_SIZE;
+	for (const int* it = first; it != last; ++it) {
+		if ((it - first) % CANCEL_CHECK == 0 && cancel && cancel->load(std::memory_order_relaxed))
+			return false;
+		const std::size_t r = *it;
+		bool match = p.op == Op::All || negate;
+		for (std::size_t k = 0; k < p.columns.size() && match == negate; ++k) {
+			const auto& values = table.columns[p.columns[k]].values;
+			if (r < values.size() && cell_matches(p, values[r]))
+				match = !negate;
+		}
+		if (match)
+			out.push_back(*it);
+	}
+	return true;
+}
+
+// Runs block(b, out) for every block on the worker pool and concatenates the results in block order.
+// block returns false if it was cancelled, the whole result is empty then.
+template <typename Block>
+static std::vector<int> run_blocks(std::size_t blocks, Block block) {
+	const std::size_t threads = std::min(blocks, WorkerCount());
+	std::vector<int> rows;
+	if (threads <= 1) {
+		for (std::size_t b = 0; b < blocks; ++b) {
+			if (!block(b, rows))
+				return {};
+		}
+		return rows;
+	}
+	// Workers take the next free block, every block has its own result so the order stays the same
+	std::vector<std::vector<int>> results(blocks);
+	std::atomic<std::size_t> next = 0;
+	std::atomic<bool> cancelled = false;
+	ParallelFor(threads, [&](std::size_t) {
+		for (std::size_t b = next++; b < blocks && !cancelled; b = next++) {
+			if (!block(b, results[b]))
+				cancelled = true;
+		}
+		});
+	if (cancelled)
+		return {};
+	std::size_t total = 0;
+	for (const auto& result : results) {
+		total += result.size();
+	}
+	rows.reserve(total);
+	for (const auto& result : results) {
+		rows.insert(rows.end(), result.begin(), result.end());
+	}
+	return rows;
+}
+
+std::shared_ptr<const NumericIndex> NumericIndexCache::get(const SheetTable& table, ColId c) {
+	const auto& values = table.columns[c].values;
+	{
+		std::lock_guard lock(mutex);
+		auto it = indexes.find(c);
+		if (it != indexes.end() && it->second->values.shares_storage(values))
+			return it->second;
+	}
+	// Built outside of the lock, another thread asking for the same column at once only costs time
+	auto index = std::make_shared<NumericIndex>();
+	index->values = values;
+	for (std::size_t r = 0; r < values.size(); ++r) {
+		const auto& value = values[r].first;
+		if (const auto* i = std::get_if<std::int64_t>(&value))
+			index->sorted.emplace_back((double)*i, (std::uint32_t)r);
+		else if (const auto* d = std::get_if<double>(&value); d && !std::isnan(*d))
+			index->sorted.emplace_back(*d, (std::uint32_t)r);
+	}
+	std::sort(index->sorted.begin(), index->sorted.end());
+	std::lock_guard lock(mutex);
+	indexes[c] = index;
+	return index;
+}
+
+void NumericIndexCache::prune(const SheetTable& table) {
+	std::lock_guard lock(mutex);
+	std::erase_if(indexes, [&](const auto& entry) {
+		return entry.first >= table.columns.size() || !entry.second->values.shares_storage(table.columns[entry.first].values);
+		});
+}
+
+// Numeric search over the sorted indexes of the searched columns, O(log n + k) per column
+static std::vector<int> match_ranges(const SheetTable& table, const FilterPredicate& p) {
+	using Op = FilterPredicate::Op;
+	using Entry = std::pair<double, std::uint32_t>;
+	std::vector<int> rows;
+	if (std::isnan(p.min) || std::isnan(p.max))
+		return rows;
+	for (ColId c : p.columns) {
+		const std::shared_ptr<const NumericIndex> index = p.ranges->get(table, c);
+		auto first = index->sorted.begin();
+		auto last = index->sorted.end();
+		const auto before = [](const Entry& e, double v) { return e.first < v; };
+		const auto after = [](double v, const Entry& e) { return v < e.first; };
+		if (p.op == Op::Range || p.op == Op::Greater)
+			first = std::upper_bound(first, last, p.min, after);
+		else if (p.op == Op::GreaterEqual)
+			first = std::lower_bound(first, last, p.min, before);
+		if (p.op == Op::Range || p.op == Op::Less)
+			last = std::lower_bound(first, last, p.max, before);
+		else if (p.op == Op::LessEqual)
+			last = std::upper_bound(first, last, p.max, after);
+		for (auto it = first; it < last; ++it) {
+			if (it->second < table.rowCount)
+				rows.push_back((int)it->second);
+		}
+	}
+	std::sort(rows.begin(), rows.end());
+	rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+	return rows;
+}
+
+static std::vector<int> set_union(const std::vector<int>& a, const std::vector<int>& b) {
+	std::vector<int> out;
+	out.reserve(a.size() + b.size());
+	std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+	return out;
+}
+
+static std::vector<int> set_difference(const std::vector<int>& a, const std::vector<int>& b) {
+	std::vector<int> out;
+	out.reserve(a.size());
+	std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+	return out;
+}
+
+// Narrows rows (ascending) down to the rows node holds for, full means rows stands for every row of the table.
+// Every clause runs over one column for all rows at once, later clauses of AND only over the rows left.
+// Returns false if it was cancelled.
+static bool eval_node(const SheetTable& table, const FilterNode& node, std::vector<int>& rows, bool full, const std::atomic<bool>* cancel) {
+	switch (node.kind) {
+	case FilterNode::Kind::Clause:
+		rows = full ? FilterRows(table, node.clause, cancel) : FilterRows(table, node.clause, rows, cancel);
+		break;
+	case FilterNode::Kind::And:
+		for (const auto& child : node.children) {
+			if (!eval_node(table, child, rows, full, cancel))
+				return false;
+			full = false;
+			if (rows.empty())
+				break;
+		}
+		break;
+	case FilterNode::Kind::Or: {
+		// A row that matched already is not checked by the later children
+		std::vector<int> matched;
+		std::vector<int> rest = std::move(rows);
+		for (const auto& child : node.children) {
+			std::vector<int> part = rest;
+			if (!eval_node(table, child, part, full, cancel))
+				return false;
+			matched = set_union(matched, part);
+			if (matched.size() == table.rowCount)
+				break;
+			if (!full) {
+				rest = set_difference(rest, part);
+				if (rest.empty())
+					break;
+			}
+		}
+		rows = std::move(matched);
+		break;
+	}
+	case FilterNode::Kind::Not: {
+		std::vector<int> part = rows;
+		if (!eval_node(table, node.children[0], part, full, cancel))
+			return false;
+		if (full) {
+			rows.resize(table.rowCount);
+			std::iota(rows.begin(), rows.end(), 0);
+		}
+		rows = set_difference(rows, part);
+		break;
+	}
+	}
+	return !(cancel && cancel->load(std::memory_order_relaxed));
+}
+
+std::vector<int> FilterRows(const SheetTable& table, const FilterPredicate& predicate, const std::atomic<bool>* cancel) {
+	if (predicate.op == FilterPredicate::Op::Query) {
+		std::vector<int> rows;
+		if (!eval_node(table, *predicate.query, rows, true, cancel))
+			return {};
+		return rows;
+	}
+	if (predicate.rangeIndexed() && !predicate.columns.empty())
+		return match_ranges(table, predicate);
+	const std::size_t blocks = (table.rowCount + FILTER_BLOCK_ROWS - 1) / FILTER_BLOCK_ROWS;
+	return run_blocks(blocks, [&](std::size_t b, std::vector<int>& out) {
+		const std::size_t begin = b * FILTER_BLOCK_ROWS;
+		return match_block(table, predicate, begin, std::min(table.rowCount, begin + FILTER_BLOCK_ROWS), out, cancel);
+		});
+}
+
+std::vector<int> FilterRows(const SheetTable& table, const FilterPredicate& predicate, const std::vector<int>& candidates, const std::atomic<bool>* cancel) {
+	const std::size_t blocks = (candidates.size() + FILTER_BLOCK_ROWS - 1) / FILTER_BLOCK_ROWS;
+	return run_blocks(blocks, [&](std::size_t b, std::vector<int>& out) {
+		const int* first = candidates.data() + b * FILTER_BLOCK_ROWS;
+		const int* last = candidates.data() + std::min(candidates.size(), (b + 1) * FILTER_BLOCK_ROWS);
+		return match_rows(table, predicate, first, last, out, cancel);
+		});
+}
+
+std::vector<int> FilterRows(const SheetTable& table, const std::string& search, const std::string& header) {
+	return FilterRows(table, CompileFilter(table, search, header));
+}
+
+void FilterCache::attach_indexes(FilterPredicate& predicate, bool singleHeader) const {
+	predicate.index = index;
+	if (!predicate.numeric())
+		predicate.packed = packed;
+	else if (singleHeader)
+		predicate.ranges = ranges;
+	// Every clause of a query is on a single column
+	if (predicate.query) {
+		std::vector<FilterNode*> open = { predicate.query.get() };
+		while (!open.empty()) {
+			FilterNode* node = open.back();
+			open.pop_back();
+			if (node->kind == FilterNode::Kind::Clause)
+				attach_indexes(node->clause, true);
+			for (auto& child : node->children) {
+				open.push_back(&child);
+			}
+		}
+	}
+}
+
+bool FilterCache::update(const SheetTable& table, const std::string& search, const std::string& header) {
+	Input next{ search, header, table.version };
+	if (generation == 0 || !(next == wanted)) {
+		wanted = std::move(next);
+		generation++;
+		// The running job is outdated now, stopping it instead of waiting for a result that gets dropped
+		if (job.valid()) {
+			cancel->store(true);
+			retired.add(std::move(job));
+			job = {};
+		}
+	}
+	retired.poll();
+	bool changed = false;
+	if (job.valid() && job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		rows = job.get();
+		rowsGeneration = jobGeneration;
+		rowsVersion = jobVersion;
+		rowsPredicate = std::move(jobPredicate);
+		changed = true;
+	}
+	// Up to date or still running
+	if (rowsGeneration == generation || job.valid())
+		return changed;
+	FilterPredicate predicate = CompileFilter(table, search, header);
+	if (packed)
+		packed->prune();
+	ranges->prune(table);
+	attach_indexes(predicate, !header.empty());
+	// A narrower search only has to look at the rows of the last result, unless an index finds the rows faster
+	const bool refine = rowsGeneration != 0 && rowsVersion == table.version && predicate.refines(rowsPredicate)
+		&& !predicate.rangeIndexed() && (!predicate.indexed() || rows.size() < FILTER_ASYNC_ROWS);
+	const std::size_t work = refine ? rows.size() : table.rowCount;
+	if (predicate.op == FilterPredicate::Op::All || work < FILTER_ASYNC_ROWS) {
+		rows = refine ? FilterRows(table, predicate, rows) : FilterRows(table, predicate);
+		rowsGeneration = generation;
+		rowsVersion = table.version;
+		rowsPredicate = std::move(predicate);
+		// Only kept for refines(), it should not hold old indexes
+		rowsPredicate.index.reset();
+		rowsPredicate.ranges.reset();
+		rowsPredicate.packed.reset();
+		rowsPredicate.query.reset();
+		return true;
+	}
+	// The copy shares the column chunks, edits of the table after this do not reach the worker
+	jobGeneration = generation;
+	jobVersion = table.version;
+	jobPredicate = predicate;
+	jobPredicate.index.reset();
+	jobPredicate.ranges.reset();
+	jobPredicate.packed.reset();
+	jobPredicate.query.reset();
+	cancel = std::make_shared<std::atomic<bool>>(false);
+	std::vector<int> candidates = refine ? rows : std::vector<int>{};
+	job = std::async(std::launch::async, [table, predicate, candidates = std::move(candidates), refine, stop = cancel]() {
+		std::vector<int> result = refine ? FilterRows(table, predicate, candidates, stop.get()) : FilterRows(table, predicate, stop.get());
+		RequestRedraw();
+		return result;
+		});
+	return changed;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "project.h"
+#include "packedstrings.h"
+#include "trigramindex.h"
+#include "retiredjobs.h"
+
+// Tables with at least this many rows are filtered on a worker thread
+constexpr std::size_t FILTER_ASYNC_ROWS = 50000;
+// Rows per block of the parallel filter, a multiple of the column chunk size
+constexpr std::size_t FILTER_BLOCK_ROWS = 16 * ChunkedVector<int>::CHUNK_SIZE;
+
+struct NumericIndexCache;
+struct FilterNode;
+
+// Search text compiled against a table, see CompileFilter for the syntax
+struct FilterPredicate {
+	enum class Op {
+		All,	// empty search
+		None,	// search that can never match, e.g. an invalid number
+		Range,	// '<min;max>' numbers strictly between min and max
+		Less,	// '<X'
+		Greater,	// '>X'
+		Contains,	// '%X'
+		NotContains,	// '!X' no searched column contains X
+		Prefix,	// 'X'
+		// Only in clauses of a query
+		LessEqual,
+		GreaterEqual,
+		Equal,	// same number, or same text if the literal or the cell is no number
+		NotEqual,
+		Query	// boolean combination of clauses, see query
+	};
+	Op op = Op::All;
+	double min = 0.0;	// also the number of Equal and NotEqual
+	double max = 0.0;
+	bool hasNumber = false;	// Equal and NotEqual: the literal is a number
+	std::string text;
+	std::vector<ColId> columns;	// searched columns
+	std::shared_ptr<FilterNode> query;	// plan of a Query
+	std::shared_ptr<const TrigramIndex> index;	// optional, narrows Contains and Prefix searches down to candidate rows
+	std::shared_ptr<NumericIndexCache> ranges;	// optional, answers numeric searches with binary searches
+	std::shared_ptr<PackedStringCache> packed;	// optional, text searches scan packed chunks instead of the cells
+
+	bool numeric() const { return op == Op::Range || op == Op::Less || op == Op::Greater || op == Op::LessEqual || op == Op::GreaterEqual; }
+	// True if every row matching this also matches previous, e.g. a longer prefix or a tighter range
+	bool refines(const FilterPredicate& previous) const;
+	bool indexed() const { return index && text.size() >= 3 && (op == Op::Contains || op == Op::Prefix); }
+	bool rangeIndexed() const { return ranges && numeric(); }
+	bool packedSearch() const { return packed && (op == Op::Contains || op == Op::NotContains || op == Op::Prefix) && !text.empty() && !text.contains('\0'); }
+};
+
+// Execution plan of a query: clauses on one column each, combined with AND, OR and NOT.
+// Children of AND and OR are sorted by cost, so cheap and selective clauses run first and
+// the later ones only look at the rows that are still undecided.
+struct FilterNode {
+	enum class Kind {
+		Clause,
+		And,
+		Or,
+		Not
+	};
+	Kind kind = Kind::Clause;
+	FilterPredicate clause;
+	std::vector<FilterNode> children;
+	int cost = 0;
+};
+
+// Numeric values of one column sorted ascending with their rows
+struct NumericIndex {
+	decltype(Column::values) values;	// column it was built from, shares its storage until the column changes
+	std::vector<std::pair<double, std::uint32_t>> sorted;	// value, row
+};
+
+// Numeric indexes of a table, built on demand for the columns that get a range search.
+// Safe to use from several threads.
+struct NumericIndexCache {
+	// Index of column c, built again if the column changed since
+	std::shared_ptr<const NumericIndex> get(const SheetTable& table, ColId c);
+	// Drops indexes of columns that changed, they would keep the old column alive
+	void prune(const SheetTable& table);
+
+private:
+	std::mutex mutex;
+	std::unordered_map<ColId, std::shared_ptr<const NumericIndex>> indexes;
+};
+
+// Parses the search text once and resolves header to column ids ("" searches all columns).
+// A query like 'Station=3 AND (Result<0,5 OR NOT Serial%X12)' is compiled into a plan if all of its columns exist,
+// it ignores header. Operators are = != < <= > >= % (contains) !% (does not contain) ^ (starts with),
+// names and values with spaces or operators go in double quotes.
+FilterPredicate CompileFilter(const SheetTable& table, const std::string& search, const std::string& header);
+
+// Rows of table that match the predicate, evaluated one column at a time without allocating per cell.
+// Large tables are split into blocks that are filtered in parallel. Returns nothing once cancel is set.
+std::vector<int> FilterRows(const SheetTable& table, const FilterPredicate& predicate, const std::atomic<bool>* cancel = nullptr);
+// Same but only looks at the candidate rows (ascending), used to narrow down an earlier result
+std::vector<int> FilterRows(const SheetTable& table, const FilterPredicate& predicate, const std::vector<int>& candidates, const std::atomic<bool>* cancel = nullptr);
+std::vector<int> FilterRows(const SheetTable& table, const std::string& search, const std::string& header);
+
+// Filter result that is kept between frames.
+// It is only computed again if the search text, the header or the table version changed.
+struct FilterCache {
+	std::vector<int> rows;	// result of the last finished filter
+	std::shared_ptr<const TrigramIndex> index;	// optional, used by searches that can use it
+	std::shared_ptr<NumericIndexCache> ranges = std::make_shared<NumericIndexCache>();	// used by numeric searches in a single header
+	std::shared_ptr<PackedStringCache> packed;	// optional, text searches scan packed chunks if set, costs a copy of the searched text
+	std::uint64_t generation = 0;	// counts the changes of search text, header and table version
+
+	// Brings rows up to date, returns true if rows changed.
+	// Large tables are filtered on a worker thread over a copy of the table, rows keep the old result until it is done.
+	// A new input cancels the running job. A search that narrows the last one only filters the rows of the last result.
+	bool update(const SheetTable& table, const std::string& search, const std::string& header);
+	bool pending() const { return job.valid(); }
+
+private:
+	// Hands the indexes to the predicate and to every clause of a query
+	void attach_indexes(FilterPredicate& predicate, bool singleHeader) const;
+
+	struct Input {
+		std::string search;
+		std::string header;
+		std::uint64_t version = 0;
+		bool operator==(const Input&) const = default;
+	};
+	Input wanted;
+	std::uint64_t rowsGeneration = 0;	// generation rows was computed for
+	std::uint64_t rowsVersion = 0;	// table version rows was computed for
+	FilterPredicate rowsPredicate;
+	std::uint64_t jobGeneration = 0;
+	std::uint64_t jobVersion = 0;
+	FilterPredicate jobPredicate;
+	std::future<std::vector<int>> job;
+	std::shared_ptr<std::atomic<bool>> cancel;	// stops job
+	RetiredJobs<std::vector<int>> retired;	// cancelled jobs that did not stop yet
+};
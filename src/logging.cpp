@@ -1,5 +1,11 @@
 #include "logging.h"
+#include "redraw.h"
 
+#include <chrono>
+#include <ctime>
+#if __has_include(<format>)
+#include <format>
+#endif
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -21,7 +27,17 @@ namespace strings {
 	
 	std::string GetTimestamp() {
 		const auto now = std::chrono::system_clock::now();
+#ifdef __cpp_lib_format
 		return std::format("{:%d-%m-%Y %H:%M:%OS}", now);
+#else
+		// Older standard libraries (gcc 12) have no std::format
+		const std::time_t t = std::chrono::system_clock::to_time_t(now);
+		const auto us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count() % 1000000;
+		char buf[64];
+		const std::size_t len = std::strftime(buf, sizeof(buf), "%d-%m-%Y %H:%M:%S", std::localtime(&t));
+		std::snprintf(buf + len, sizeof(buf) - len, ".%06lld", (long long)us);
+		return buf;
+#endif
 	}
 }
 
@@ -35,6 +51,8 @@ namespace logging {
 	namespace fs = std::filesystem;
 	
 	void log(const std::string& type, const std::string& msg) {
+		// The log window shows it on the next frame
+		RequestRedraw();
 		if (type == "[ERROR]") {
 			std::cerr << strings::GetTimestamp() << "\t" << type << "\t" << msg << "\n";
 			lastError = msg;
@@ -0,0 +1,369 @@
+#include "merge.h"
+#include "fileloader.h"
+#include "parallelsort.h"
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+static std::uint64_t mix64(std::uint64_t x) {
+	// splitmix64 finalizer
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return x;
+}
+
+std::uint64_t hash_value(const ExcelValue& v) {
+	std::uint64_t h = 0;
+	if (auto* d = std::get_if<double>(&v)) {
+		// -0.0 == 0.0 so both have to hash the same
+		h = (*d == 0.0) ? 0 : std::bit_cast<std::uint64_t>(*d);
+	}
+	else if (auto* i = std::get_if<std::int64_t>(&v)) {
+		h = static_cast<std::uint64_t>(*i);
+	}
+	else if (auto* b = std::get_if<bool>(&v)) {
+		h = *b ? 1 : 0;
+	}
+	else if (auto* s = std::get_if<std::string>(&v)) {
+		h = std::hash<std::string_view>{}(*s);
+	}
+	return mix64(h + v.index() * 0x9E3779B97F4A7C15ull);
+}
+
+static std::string canonical_number(double d) {
+	char buf[64];
+	// Integral values print without decimals so 421 and 421.0 are the same
+	if (d == std::floor(d) && std::fabs(d) < 9007199254740992.0)
+		std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(d));
+	else
+		std::snprintf(buf, sizeof(buf), "%.17g", d);
+	return buf;
+}
+
+// Length of a leading '+' or '-'
+static std::size_t sign_length(const std::string& s) {
+	return (!s.empty() && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+}
+
+static bool has_leading_zero(const std::string& s) {
+	const std::size_t i = sign_length(s);
+	return s.size() > i + 1 && s[i] == '0' && std::isdigit((unsigned char)s[i + 1]);
+}
+
+static std::string strip_leading_zeros(const std::string& s) {
+	const std::size_t sign = sign_length(s);
+	std::size_t i = sign;
+	while (i + 1 < s.size() && s[i] == '0' && std::isdigit((unsigned char)s[i + 1]))
+		++i;
+	return s.substr(0, sign) + s.substr(i);
+}
+
+// Plain decimal numbers only: sign, digits with one '.', exponent. Hex, inf and nan stay text.
+static bool parse_decimal(const std::string& s, double& value) {
+	std::size_t i = sign_length(s);
+	const std::size_t first = i;
+	auto digits = [&]() {
+		const std::size_t start = i;
+		while (i < s.size() && std::isdigit((unsigned char)s[i]))
+			++i;
+		return i - start;
+	};
+	std::size_t mantissa = digits();
+	if (i < s.size() && s[i] == '.') {
+		++i;
+		mantissa += digits();
+	}
+	if (mantissa == 0)
+		return false;
+	if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+		++i;
+		if (i < s.size() && (s[i] == '-' || s[i] == '+'))
+			++i;
+		if (digits() == 0)
+			return false;
+	}
+	if (i != s.size())
+		return false;
+	// from_chars takes no '+'
+	const char* begin = s.data() + (s[0] == '+' ? first : 0);
+	const auto result = std::from_chars(begin, s.data() + s.size(), value, std::chars_format::general);
+	return result.ec == std::errc() && result.ptr == s.data() + s.size();
+}
+
+std::string canonical_key(const ExcelValue& v, const KeyNormalization& normalization) {
+	// The first character tags the type, so text and numbers only meet if intended
+	if (auto* d = std::get_if<double>(&v))
+		return "n" + canonical_number(*d);
+	if (auto* i = std::get_if<std::int64_t>(&v))
+		return "n" + std::to_string(*i);
+	if (auto* b = std::get_if<bool>(&v))
+		return *b ? "btrue" : "bfalse";
+	auto* str = std::get_if<std::string>(&v);
+	if (!str)
+		return "";
+	std::string s = normalization.trim ? fileloader::csv::trim_ws(*str) : *str;
+	if (s.empty())
+		return "";
+	if (normalization.numeric && (normalization.stripLeadingZeros || !has_leading_zero(s))) {
+		double d = 0.0;
+		if (parse_decimal(normalize_decimal(s), d))
+			return "n" + canonical_number(d);
+	}
+	if (normalization.stripLeadingZeros)
+		s = strip_leading_zeros(s);
+	if (normalization.caseFold)
+		std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return "s" + s;
+}
+
+void KeyView::build(const std::vector<const Column*>& cols, const KeyNormalization& normalization) {
+	columns = cols;
+	this->normalization = normalization;
+	canonical.assign(normalization.active() ? columns.size() : 0, {});
+	hashes.clear();
+	extend();
+}
+
+void KeyView::extend() {
+	const std::size_t from = hashes.size();
+	std::size_t rowCount = from;
+	for (const Column* col : columns) {
+		rowCount = std::max(rowCount, col->values.size());
+	}
+	hashes.resize(rowCount, 0);
+	// Column at a time, combining the hash of every part into the row hash
+	for (std::size_t c = 0; c < columns.size(); ++c) {
+		const Column* col = columns[c];
+		if (!canonical.empty()) {
+			std::vector<std::string>& keys = canonical[c];
+			keys.resize(rowCount);
+			for (std::size_t r = from; r < std::min(rowCount, col->values.size()); ++r) {
+				keys[r] = canonical_key(col->values[r].first, normalization);
+			}
+			for (std::size_t r = from; r < rowCount; ++r) {
+				hashes[r] = mix64(hashes[r] * 31 + std::hash<std::string_view>{}(keys[r]));
+			}
+			continue;
+		}
+		const std::uint64_t missing = hash_value(std::monostate{});
+		for (std::size_t r = from; r < rowCount; ++r) {
+			const std::uint64_t h = r < col->values.size() ? hash_value(col->values[r].first) : missing;
+			hashes[r] = mix64(hashes[r] * 31 + h);
+		}
+	}
+}
+
+bool KeyView::equal(std::size_t row, const KeyView& other, std::size_t otherRow) const {
+	if (hashes[row] != other.hashes[otherRow] || columns.size() != other.columns.size())
+		return false;
+	if (!canonical.empty() && canonical.size() == other.canonical.size()) {
+		for (std::size_t c = 0; c < canonical.size(); ++c) {
+			if (canonical[c][row] != other.canonical[c][otherRow])
+				return false;
+		}
+		return true;
+	}
+	static const ExcelValue missing = std::monostate{};
+	for (std::size_t c = 0; c < columns.size(); ++c) {
+		const auto& a = columns[c]->values;
+		const auto& b = other.columns[c]->values;
+		const ExcelValue& va = row < a.size() ? a[row].first : missing;
+		const ExcelValue& vb = otherRow < b.size() ? b[otherRow].first : missing;
+		if (!(va == vb))
+			return false;
+	}
+	return true;
+}
+
+bool KeyView::empty(std::size_t row) const {
+	if (!canonical.empty()) {
+		for (const auto& keys : canonical) {
+			if (!keys[row].empty())
+				return false;
+		}
+		return true;
+	}
+	for (const Column* col : columns) {
+		if (row < col->values.size() && !std::holds_alternative<std::monostate>(col->values[row].first))
+			return false;
+	}
+	return true;
+}
+
+JoinStrategy choose_join_strategy(std::size_t dstRows) {
+	if (dstRows * HASH_JOIN_BYTES_PER_ROW > HASH_JOIN_MEMORY_LIMIT)
+		return JoinStrategy::SortMerge;
+	return JoinStrategy::Hash;
+}
+
+const char* join_strategy_name(JoinStrategy strategy) {
+	switch (strategy) {
+	case JoinStrategy::Hash:
+		return "Hash";
+	case JoinStrategy::SortMerge:
+		return "Sort-Merge";
+	default:
+		return "Auto";
+	}
+}
+
+void KeyIndex::extend(const KeyView& keys) {
+	firstRows.reserve(keys.rows());
+	for (std::uint32_t r = (std::uint32_t)rows; r < keys.rows(); ++r) {
+		if (find(keys, keys, r) == NO_MATCH)
+			firstRows.emplace(keys.hashes[r], r);
+	}
+	rows = keys.rows();
+}
+
+std::uint32_t KeyIndex::find(const KeyView& keys, const KeyView& other, std::size_t otherRow) const {
+	auto range = firstRows.equal_range(other.hashes[otherRow]);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (keys.equal(it->second, other, otherRow))
+			return it->second;
+	}
+	return NO_MATCH;
+}
+
+MergeIndexCache::Entry& MergeIndexCache::get(const SheetTable& dst, const std::vector<const Column*>& cols, const KeyNormalization& normalization) {
+	std::vector<ColId> ids;
+	for (const Column* col : cols) {
+		ids.push_back(static_cast<ColId>(col - dst.columns.data()));
+	}
+	for (auto& entry : entries) {
+		if (entry.columns == ids && entry.keys.normalization == normalization) {
+			reused++;
+			return entry;
+		}
+	}
+	Entry& entry = entries.emplace_back();
+	entry.columns = std::move(ids);
+	entry.keys.build(cols, normalization);
+	entry.index.extend(entry.keys);
+	return entry;
+}
+
+void MergeIndexCache::update(const std::vector<ColId>& overwritten) {
+	std::erase_if(entries, [&](const Entry& entry) {
+		return std::any_of(entry.columns.begin(), entry.columns.end(), [&](ColId id) {
+			return std::find(overwritten.begin(), overwritten.end(), id) != overwritten.end();
+			});
+		});
+	for (auto& entry : entries) {
+		entry.keys.extend();
+		entry.index.extend(entry.keys);
+	}
+}
+
+// Hash join
+std::vector<std::uint32_t> MatchKeys(const KeyView& dst, const KeyIndex& index, const KeyView& src, bool markDuplicates) {
+	std::vector<std::uint32_t> result(src.rows(), NO_MATCH);
+	std::unordered_multimap<std::uint64_t, std::uint32_t> unmatched;
+	for (std::uint32_t r = 0; r < src.rows(); ++r) {
+		result[r] = index.find(dst, src, r);
+		if (result[r] != NO_MATCH || !markDuplicates)
+			continue;
+		auto range = unmatched.equal_range(src.hashes[r]);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (src.equal(it->second, src, r)) {
+				result[r] = DUPLICATE_KEY;
+				break;
+			}
+		}
+		if (result[r] == NO_MATCH)
+			unmatched.emplace(src.hashes[r], r);
+	}
+	return result;
+}
+
+static std::vector<std::uint32_t> hash_join(const KeyView& dst, const KeyView& src, bool markDuplicates) {
+	// Only the first row of every distinct key is indexed
+	KeyIndex index;
+	index.extend(dst);
+	return MatchKeys(dst, index, src, markDuplicates);
+}
+
+// Sort-merge join
+struct KeyRow {
+	std::uint64_t hash;
+	std::uint32_t row;
+	bool operator<(const KeyRow& o) const { return hash < o.hash || (hash == o.hash && row < o.row); }
+};
+
+static std::vector<KeyRow> sorted_keys(const KeyView& keys) {
+	std::vector<KeyRow> sorted(keys.rows());
+	for (std::uint32_t r = 0; r < keys.rows(); ++r) {
+		sorted[r] = { keys.hashes[r], r };
+	}
+	ParallelSort(sorted.begin(), sorted.end());
+	return sorted;
+}
+
+static std::vector<std::uint32_t> sort_merge_join(const KeyView& dst, const KeyView& src, bool markDuplicates) {
+	std::vector<std::uint32_t> result(src.rows(), NO_MATCH);
+	std::vector<KeyRow> d = sorted_keys(dst);
+	std::vector<KeyRow> s = sorted_keys(src);
+	// Distinct keys of the current hash group. Nearly always a single one, collisions add more.
+	std::vector<std::uint32_t> dstReps;
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> srcReps;	// source row, result
+	std::size_t i = 0;
+	std::size_t j = 0;
+	while (j < s.size()) {
+		const std::uint64_t h = s[j].hash;
+		while (i < d.size() && d[i].hash < h) {
+			++i;
+		}
+		// Rows are ascending within a hash group, so the first equal row is the one std::find would return
+		dstReps.clear();
+		for (; i < d.size() && d[i].hash == h; ++i) {
+			bool known = false;
+			for (std::uint32_t rep : dstReps) {
+				if (dst.equal(rep, dst, d[i].row)) {
+					known = true;
+					break;
+				}
+			}
+			if (!known)
+				dstReps.push_back(d[i].row);
+		}
+		srcReps.clear();
+		for (; j < s.size() && s[j].hash == h; ++j) {
+			const std::uint32_t row = s[j].row;
+			bool known = false;
+			for (const auto& [rep, match] : srcReps) {
+				if (src.equal(rep, src, row)) {
+					result[row] = (match == NO_MATCH && markDuplicates) ? DUPLICATE_KEY : match;
+					known = true;
+					break;
+				}
+			}
+			if (known)
+				continue;
+			for (std::uint32_t rep : dstReps) {
+				if (dst.equal(rep, src, row)) {
+					result[row] = rep;
+					break;
+				}
+			}
+			srcReps.emplace_back(row, result[row]);
+		}
+	}
+	return result;
+}
+
+std::vector<std::uint32_t> MatchKeys(const KeyView& dst, const KeyView& src, bool markDuplicates, JoinStrategy strategy) {
+	if (strategy == JoinStrategy::Auto)
+		strategy = choose_join_strategy(dst.rows());
+	if (strategy == JoinStrategy::SortMerge)
+		return sort_merge_join(dst, src, markDuplicates);
+	return hash_join(dst, src, markDuplicates);
+}
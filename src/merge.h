@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "project.h"
+
+// Result of MatchKeys for source rows without a destination row
+constexpr std::uint32_t NO_MATCH = UINT32_MAX;
+// Result of MatchKeys for source rows whose key already appeared in an earlier, unmatched source row
+constexpr std::uint32_t DUPLICATE_KEY = UINT32_MAX - 1;
+
+enum class JoinStrategy {
+	Auto,		// Hash below the memory threshold, SortMerge above
+	Hash,		// hash table over the destination keys
+	SortMerge	// sorted (hash, row) pairs of both sides and one linear merge pass
+};
+
+// The hash join needs roughly this many bytes per destination row (node + bucket + hash)
+constexpr std::size_t HASH_JOIN_BYTES_PER_ROW = 64;
+// Hash joins estimated above this size switch to the sort-merge join
+constexpr std::size_t HASH_JOIN_MEMORY_LIMIT = 256ull * 1024 * 1024;
+
+// Keys of one side of a merge, hashed once per row.
+// Composite keys hash and compare the tuple of all key columns without building concatenated strings.
+// With an active KeyNormalization every key column is converted to its canonical form once and compared by that.
+struct KeyView {
+	std::vector<const Column*> columns;
+	KeyNormalization normalization;
+	std::vector<std::vector<std::string>> canonical;	// per key column, empty without normalization
+	std::vector<std::uint64_t> hashes;
+
+	void build(const std::vector<const Column*>& cols, const KeyNormalization& normalization = {});
+	// Hashes the rows appended to the columns since build or the last extend
+	void extend();
+	std::size_t rows() const { return hashes.size(); }
+	bool equal(std::size_t row, const KeyView& other, std::size_t otherRow) const;
+	bool empty(std::size_t row) const;	// every key column is empty
+};
+
+// Hash index over the first row of every distinct key of a KeyView
+struct KeyIndex {
+	std::unordered_multimap<std::uint64_t, std::uint32_t> firstRows;
+	std::size_t rows = 0;	// rows of the KeyView already indexed
+
+	// Indexes the rows added to keys since the last call
+	void extend(const KeyView& keys);
+	// First row of keys equal to otherRow of other, NO_MATCH if there is none
+	std::uint32_t find(const KeyView& keys, const KeyView& other, std::size_t otherRow) const;
+};
+
+// Destination key indexes shared by all rules of one merge run.
+// Rules with the same destination key columns and normalization reuse one index instead of hashing the destination again.
+struct MergeIndexCache {
+	struct Entry {
+		std::vector<ColId> columns;
+		KeyView keys;
+		KeyIndex index;
+	};
+	std::vector<Entry> entries;
+	std::size_t reused = 0;	// lookups served by an existing index
+
+	Entry& get(const SheetTable& dst, const std::vector<const Column*>& cols, const KeyNormalization& normalization);
+	// Call after every merge into dst: indexes appended rows and drops indexes whose key cells were overwritten
+	void update(const std::vector<ColId>& overwritten);
+};
+
+std::uint64_t hash_value(const ExcelValue& v);
+// Canonical text of a key value, empty for empty values. Numbers and text only share a form with normalization.numeric.
+std::string canonical_key(const ExcelValue& v, const KeyNormalization& normalization);
+// Only the destination side is indexed, so its size alone decides
+JoinStrategy choose_join_strategy(std::size_t dstRows);
+const char* join_strategy_name(JoinStrategy strategy);
+
+// Returns for every source row the first destination row with an equal key.
+// Unmatched rows get NO_MATCH, or DUPLICATE_KEY if markDuplicates is set and an earlier unmatched source row had the same key.
+std::vector<std::uint32_t> MatchKeys(const KeyView& dst, const KeyView& src, bool markDuplicates, JoinStrategy strategy = JoinStrategy::Auto);
+// Same as the hash join, with an index over dst that is already built
+std::vector<std::uint32_t> MatchKeys(const KeyView& dst, const KeyIndex& index, const KeyView& src, bool markDuplicates);
@@ -0,0 +1,121 @@
+#include "packedstrings.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NIMBLE_SSE2 1
+#endif
+
+std::shared_ptr<const PackedChunk> PackChunk(std::shared_ptr<const PackedChunk::Chunk> chunk) {
+	auto packed = std::make_shared<PackedChunk>();
+	std::size_t bytes = 0;
+	for (const auto& cell : *chunk) {
+		bytes += cell.second.size() + 1;
+	}
+	packed->bytes.reserve(bytes);
+	packed->offsets.reserve(chunk->size() + 1);
+	for (const auto& cell : *chunk) {
+		packed->offsets.push_back((std::uint32_t)packed->bytes.size());
+		packed->bytes += '\0';
+		packed->bytes += cell.second;
+	}
+	packed->offsets.push_back((std::uint32_t)packed->bytes.size());
+	packed->chunk = std::move(chunk);
+	return packed;
+}
+
+std::size_t FindSubstring(std::string_view haystack, std::string_view needle, std::size_t from) {
+	const std::size_t k = needle.size();
+	if (k == 0 || haystack.size() < k || from > haystack.size() - k)
+		return k == 0 && from <= haystack.size() ? from : std::string_view::npos;
+	const char* s = haystack.data();
+	const std::size_t lastStart = haystack.size() - k;
+	std::size_t i = from;
+#ifdef NIMBLE_SSE2
+	// Mula: candidates are the positions where the first and the last byte both match
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[k - 1]);
+	for (; i + 15 <= lastStart; i += 16) {
+		const __m128i blockFirst = _mm_loadu_si128((const __m128i*)(s + i));
+		const __m128i blockLast = _mm_loadu_si128((const __m128i*)(s + i + k - 1));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+		while (mask) {
+			const std::size_t pos = i + std::countr_zero(mask);
+			if (k < 3 || std::memcmp(s + pos + 1, needle.data() + 1, k - 2) == 0)
+				return pos;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	return haystack.find(needle, i);
+}
+
+void PackedFind(const PackedChunk& packed, std::string_view needle, std::vector<std::uint16_t>& rows) {
+	rows.clear();
+	const std::string_view bytes = packed.bytes;
+	std::size_t pos = FindSubstring(bytes, needle);
+	while (pos != std::string_view::npos) {
+		// Row of the match, the search goes on after the end of that row
+		const std::size_t row = std::upper_bound(packed.offsets.begin(), packed.offsets.end(), (std::uint32_t)pos) - packed.offsets.begin() - 1;
+		rows.push_back((std::uint16_t)row);
+		pos = FindSubstring(bytes, needle, packed.offsets[row + 1]);
+	}
+}
+
+static std::size_t packed_bytes(const PackedChunk& packed) {
+	return packed.bytes.capacity() + packed.offsets.capacity() * sizeof(std::uint32_t);
+}
+
+std::shared_ptr<const PackedChunk> PackedStringCache::get(const decltype(Column::values)& values, std::size_t c) {
+	{
+		std::lock_guard lock(mutex);
+		auto it = chunks.find(values.chunk(c));
+		if (it != chunks.end()) {
+			it->second.lastUse = ++uses;
+			return it->second.packed;
+		}
+	}
+	std::shared_ptr<const PackedChunk> packed = PackChunk(values.shared_chunk(c));
+	std::lock_guard lock(mutex);
+	auto [it, inserted] = chunks.try_emplace(packed->chunk.get(), Entry{ packed, ++uses });
+	if (inserted) {
+		bytes += packed_bytes(*packed);
+		if (bytes > budget)
+			evict();
+	}
+	return packed;
+}
+
+void PackedStringCache::evict() {
+	std::vector<std::pair<std::uint64_t, const PackedChunk::Chunk*>> order;
+	order.reserve(chunks.size());
+	for (const auto& [chunk, entry] : chunks) {
+		order.emplace_back(entry.lastUse, chunk);
+	}
+	std::sort(order.begin(), order.end());
+	// Down to three quarters, so a scan over more than budget does not sort on every new chunk
+	for (const auto& [lastUse, chunk] : order) {
+		if (bytes <= budget / 4 * 3)
+			break;
+		auto it = chunks.find(chunk);
+		bytes -= packed_bytes(*it->second.packed);
+		chunks.erase(it);
+	}
+}
+
+void PackedStringCache::prune() {
+	std::lock_guard lock(mutex);
+	std::erase_if(chunks, [&](const auto& entry) {
+		if (entry.second.packed->chunk.use_count() != 1)
+			return false;
+		bytes -= packed_bytes(*entry.second.packed);
+		return true;
+		});
+}
+
+std::size_t PackedStringCache::memoryUsage() const {
+	std::lock_guard lock(mutex);
+	return bytes;
+}
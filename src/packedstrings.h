@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "project.h"
+
+// Display strings of one column chunk packed into one buffer, every cell starts with a '\0'.
+// A substring search then runs over one contiguous buffer instead of one heap string per cell,
+// and a prefix search is a search for '\0' + text.
+struct PackedChunk {
+	using Chunk = decltype(Column::values)::Chunk;
+	std::shared_ptr<const Chunk> chunk;	// holding it makes an edit copy the chunk, so the packed bytes never go stale
+	std::string bytes;
+	std::vector<std::uint32_t> offsets;	// position of the '\0' of every row, plus bytes.size() at the end
+};
+
+std::shared_ptr<const PackedChunk> PackChunk(std::shared_ptr<const PackedChunk::Chunk> chunk);
+
+// Position of the first needle in haystack at or after from, std::string_view::npos if there is none.
+// Compares the first and last byte of needle 16 positions at a time (SSE2) before comparing the rest.
+std::size_t FindSubstring(std::string_view haystack, std::string_view needle, std::size_t from = 0);
+
+// Rows of the chunk (ascending) whose text contains needle, needle must not be empty
+void PackedFind(const PackedChunk& packed, std::string_view needle, std::vector<std::uint16_t>& rows);
+
+// Packed chunks built on demand by the filter, safe to use from several threads.
+// Holds at most budget bytes, the chunks used longest ago are dropped first.
+struct PackedStringCache {
+	std::size_t budget = 256ull * 1024 * 1024;
+
+	std::shared_ptr<const PackedChunk> get(const decltype(Column::values)& values, std::size_t c);
+	// Drops chunks that only the cache still holds
+	void prune();
+	std::size_t memoryUsage() const;
+
+private:
+	struct Entry {
+		std::shared_ptr<const PackedChunk> packed;
+		std::uint64_t lastUse = 0;
+	};
+	// Drops the least recently used entries until bytes is below three quarters of budget, mutex has to be held
+	void evict();
+
+	mutable std::mutex mutex;
+	std::unordered_map<const PackedChunk::Chunk*, Entry> chunks;
+	std::size_t bytes = 0;
+	std::uint64_t uses = 0;
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <iterator>
+#include <vector>
+#include "workerpool.h"
+
+// Below this many elements a single std::sort is faster than splitting the work
+constexpr std::size_t PARALLEL_SORT_MIN = 1 << 16;
+
+// Sorts equally sized chunks in parallel, then merges neighbours pairwise until one run is left
+template <typename It, typename Compare = std::less<>>
+void ParallelSort(It first, It last, Compare comp = {}) {
+	const std::size_t size = (std::size_t)std::distance(first, last);
+	const std::size_t threads = WorkerCount();
+	if (size < PARALLEL_SORT_MIN || threads == 1) {
+		std::sort(first, last, comp);
+		return;
+	}
+	std::size_t chunks = std::bit_floor(threads);
+	std::vector<std::size_t> bounds(chunks + 1);
+	for (std::size_t i = 0; i <= chunks; ++i) {
+		bounds[i] = size * i / chunks;
+	}
+	ParallelFor(chunks, [&](std::size_t i) {
+		std::sort(first + bounds[i], first + bounds[i + 1], comp);
+		});
+	for (std::size_t width = 1; width < chunks; width *= 2) {
+		ParallelFor((chunks + 2 * width - 1) / (2 * width), [&](std::size_t pair) {
+			const std::size_t i = pair * 2 * width;
+			if (i + width >= chunks)
+				return;
+			const std::size_t begin = bounds[i];
+			const std::size_t middle = bounds[i + width];
+			const std::size_t end = bounds[std::min(i + 2 * width, chunks)];
+			std::inplace_merge(first + begin, first + middle, first + end, comp);
+			});
+	}
+}
@@ -1,8 +1,11 @@
 #include "project.h"
+#include <atomic>
 #include <fstream>
+#include <unordered_set>
 #include "logging.h"
 #include "utils.h"
 #include "fileloader.h"
+#include "merge.h"
 #include <tinyxml2.h>
 #include <xlnt/xlnt.hpp>
 #include <xlnt/xlnt_config.hpp>
@@ -15,12 +18,41 @@ namespace fl = fileloader;
 // loading functions predefs
 SheetTable load_sheet_csv(const std::string& filePath, const std::string& sheet, SheetSettings& sheetSettings);
 
+std::uint64_t next_table_version() {
+	static std::atomic<std::uint64_t> counter = 0;
+	return ++counter;
+}
+
+static void refresh_label(const Column& column) {
+	if (column.labelKey.occurrence == column.key.occurrence && column.labelKey.name == column.key.name)
+		return;
+	column.labelKey = column.key;
+	column.label = header_label(column.key);
+	// FNV-1a of the label
+	std::uint32_t h = 2166136261u;
+	for (const char c : column.label) {
+		h = (h ^ (unsigned char)c) * 16777619u;
+	}
+	column.labelId = h;
+}
+
+const std::string& column_label(const Column& column) {
+	refresh_label(column);
+	return column.label;
+}
+
+std::uint32_t column_id(const Column& column) {
+	refresh_label(column);
+	return column.labelId;
+}
+
 void SheetTable::clear() {
 	name.clear();
 	path.clear();
 	sheets.clear();
 	activeSheet.clear();
 	columns.clear();
+	touch();
 }
 
 void Project::load(const std::string& name, const std::string& path){
@@ -99,6 +131,13 @@ void Project::loadfile(const std::string& path, const std::string& sheet) {
 		const std::string sn = activeFile.activeSheet;
 		sheetSettings[sheet_key(path, sn)] = ss;
 	}
+	history.clear();
+	// Unsaved merges are gone with the reloaded file
+	for (auto& [k, msv] : mergeSettings) {
+		for (auto& ms : msv) {
+			ms.pendingLedger.clear();
+		}
+	}
 	save_all_sheetsettings();
 	save_all_mergesettings();
 }
@@ -137,6 +176,7 @@ void Project::clear(){
 	mergeSettingsLoaded = false;
 	mergeSettings.clear();
 	activeFile = {};
+	history.clear();
 	loaded = false;
 }
 
@@ -159,6 +199,143 @@ void Project::save() {
 	file << "selected_sheet = " << activeFile.activeSheet << "\n";
 }
 
+void Project::commitMergeLedgers() {
+	for (auto& ms : *getCurrentMergeSettingsHandle()) {
+		for (auto& [file, entry] : ms.pendingLedger) {
+			ms.ledger[file] = entry;
+		}
+		ms.pendingLedger.clear();
+	}
+	save_all_mergesettings();
+}
+
+static TableSnapshot take_snapshot(const SheetTable& table, const std::vector<MergeSettings>& msv, const std::string& label) {
+	TableSnapshot snap;
+	snap.label = label;
+	snap.rowCount = table.rowCount;
+	snap.columns = table.columns;
+	snap.byName = table.byName;
+	for (const auto& ms : msv) {
+		snap.pendingLedgers[ms.name] = ms.pendingLedger;
+	}
+	return snap;
+}
+
+static void restore_snapshot(SheetTable& table, std::vector<MergeSettings>& msv, TableSnapshot& snap) {
+	table.rowCount = snap.rowCount;
+	table.columns = std::move(snap.columns);
+	table.byName = std::move(snap.byName);
+	table.touch();
+	for (auto& ms : msv) {
+		auto it = snap.pendingLedgers.find(ms.name);
+		if (it != snap.pendingLedgers.end())
+			ms.pendingLedger = std::move(it->second);
+	}
+}
+
+void Project::snapshot(const std::string& label) {
+	history.undoStack.push_back(take_snapshot(activeFile, *getCurrentMergeSettingsHandle(), label));
+	history.redoStack.clear();
+	history.trim(activeFile);
+}
+
+bool Project::undo() {
+	if (history.undoStack.empty())
+		return false;
+	TableSnapshot snap = std::move(history.undoStack.back());
+	history.undoStack.pop_back();
+	std::vector<MergeSettings>& msv = *getCurrentMergeSettingsHandle();
+	history.redoStack.push_back(take_snapshot(activeFile, msv, snap.label));
+	restore_snapshot(activeFile, msv, snap);
+	logging::loginfo("[Project::undo] %s", history.redoStack.back().label.c_str());
+	return true;
+}
+
+bool Project::redo() {
+	if (history.redoStack.empty())
+		return false;
+	TableSnapshot snap = std::move(history.redoStack.back());
+	history.redoStack.pop_back();
+	std::vector<MergeSettings>& msv = *getCurrentMergeSettingsHandle();
+	history.undoStack.push_back(take_snapshot(activeFile, msv, snap.label));
+	restore_snapshot(activeFile, msv, snap);
+	logging::loginfo("[Project::redo] %s", history.undoStack.back().label.c_str());
+	return true;
+}
+
+using HistoryChunk = decltype(Column::values)::Chunk;
+
+// Strings longer than the small buffer are not counted, good enough for a limit
+static std::size_t chunk_bytes(const HistoryChunk* chunk) {
+	return chunk->capacity() * sizeof(HistoryChunk::value_type);
+}
+
+static std::unordered_set<const HistoryChunk*> table_chunks(const SheetTable& table) {
+	std::unordered_set<const HistoryChunk*> chunks;
+	for (const auto& col : table.columns) {
+		for (std::size_t c = 0; c < col.values.chunk_count(); c++) {
+			chunks.insert(col.values.chunk(c));
+		}
+	}
+	return chunks;
+}
+
+std::size_t TableHistory::memoryUsage(const SheetTable& table) const {
+	std::unordered_set<const HistoryChunk*> seen = table_chunks(table);
+	std::size_t bytes = 0;
+	auto count = [&](const std::vector<TableSnapshot>& stack) {
+		for (const auto& snap : stack) {
+			for (const auto& col : snap.columns) {
+				for (std::size_t c = 0; c < col.values.chunk_count(); c++) {
+					const HistoryChunk* chunk = col.values.chunk(c);
+					if (seen.insert(chunk).second)
+						bytes += chunk_bytes(chunk);
+				}
+			}
+		}
+	};
+	count(undoStack);
+	count(redoStack);
+	return bytes;
+}
+
+void TableHistory::trim(const SheetTable& table) {
+	if (undoStack.size() > maxSteps)
+		undoStack.erase(undoStack.begin(), undoStack.end() - maxSteps);
+	if (undoStack.size() <= 1)
+		return;
+	// Count the references on every snapshot chunk once, dropping a step then frees the chunks it held last
+	const std::unordered_set<const HistoryChunk*> live = table_chunks(table);
+	std::unordered_map<const HistoryChunk*, std::size_t> refs;
+	std::size_t bytes = 0;
+	auto count = [&](const std::vector<TableSnapshot>& stack) {
+		for (const auto& snap : stack) {
+			for (const auto& col : snap.columns) {
+				for (std::size_t c = 0; c < col.values.chunk_count(); c++) {
+					const HistoryChunk* chunk = col.values.chunk(c);
+					if (refs[chunk]++ == 0 && !live.contains(chunk))
+						bytes += chunk_bytes(chunk);
+				}
+			}
+		}
+	};
+	count(undoStack);
+	count(redoStack);
+	// The newest step is kept even if it alone is above the limit
+	std::size_t dropped = 0;
+	while (undoStack.size() - dropped > 1 && bytes > memoryLimit) {
+		for (const auto& col : undoStack[dropped].columns) {
+			for (std::size_t c = 0; c < col.values.chunk_count(); c++) {
+				const HistoryChunk* chunk = col.values.chunk(c);
+				if (--refs[chunk] == 0 && !live.contains(chunk))
+					bytes -= chunk_bytes(chunk);
+			}
+		}
+		dropped++;
+	}
+	undoStack.erase(undoStack.begin(), undoStack.begin() + dropped);
+}
+
 void Project::load_all_sheetsettings(){
 	sheetSettingsLoaded = true;
 	sheetSettings.clear();
@@ -276,6 +453,10 @@ void Project::load_all_mergesettings() {
 						else if (line.starts_with("src_key_name = ")) rule.key.srcHeader.name = read_value(line);
 						else if (line.starts_with("src_key_occ = ")) rule.key.srcHeader.occurrence = std::stoi(read_value(line));
 						else if (line.starts_with("reverseKey = ")) rule.reverseKey = (read_value(line) == "1");
+						else if (line.starts_with("key_trim = ")) rule.keyNormalization.trim = (read_value(line) == "1");
+						else if (line.starts_with("key_caseFold = ")) rule.keyNormalization.caseFold = (read_value(line) == "1");
+						else if (line.starts_with("key_numeric = ")) rule.keyNormalization.numeric = (read_value(line) == "1");
+						else if (line.starts_with("key_stripLeadingZeros = ")) rule.keyNormalization.stripLeadingZeros = (read_value(line) == "1");
 						else if (line.starts_with("mergeHeaders_count = ")) expectedHeaders = std::stoi(read_value(line));
 						else if (line == "BEGIN_HEADER") {
 							MergeHeaders headers;
@@ -293,6 +474,41 @@ void Project::load_all_mergesettings() {
 								else if (line.starts_with("src_occ = ")) headers.srcHeader.occurrence = std::stoi(read_value(line));
 							}
 						}
+						else if (line == "BEGIN_KEY") {
+							MergeHeaders key;
+							while (std::getline(in, line)) {
+								ReplaceAllSubstrings(line, "\r", "");
+								ReplaceAllSubstrings(line, "\n", "");
+
+								if (line == "END_KEY") {
+									rule.extraKeys.push_back(key);
+									break;
+								}
+								if (line.starts_with("dst_name = ")) key.dstHeader.name = read_value(line);
+								else if (line.starts_with("dst_occ = ")) key.dstHeader.occurrence = std::stoi(read_value(line));
+								else if (line.starts_with("src_name = ")) key.srcHeader.name = read_value(line);
+								else if (line.starts_with("src_occ = ")) key.srcHeader.occurrence = std::stoi(read_value(line));
+							}
+						}
+						else if (line == "BEGIN_LEDGER") {
+							std::string file;
+							MergeLedgerEntry entry;
+							while (std::getline(in, line)) {
+								ReplaceAllSubstrings(line, "\r", "");
+								ReplaceAllSubstrings(line, "\n", "");
+
+								if (line == "END_LEDGER") {
+									if (!file.empty())
+										rule.ledger[file] = entry;
+									break;
+								}
+								if (line.starts_with("path = ")) file = read_value(line);
+								else if (line.starts_with("size = ")) entry.size = std::stoull(read_value(line));
+								else if (line.starts_with("mtime = ")) entry.mtime = std::stoll(read_value(line));
+								else if (line.starts_with("hash = ")) entry.hash = std::stoull(read_value(line));
+								else if (line.starts_with("rows = ")) entry.rows = std::stoull(read_value(line));
+							}
+						}
 					}
 				}
 			}
@@ -329,7 +545,20 @@ void Project::save_all_mergesettings() const {
 			out << "dst_key_occ = " << rule.key.dstHeader.occurrence << "\n";
 			out << "src_key_name = " << rule.key.srcHeader.name << "\n";
 			out << "src_key_occ = " << rule.key.srcHeader.occurrence << "\n";
+			out << "extraKeys_count = " << rule.extraKeys.size() << "\n";
+			for (const auto& key : rule.extraKeys) {
+				out << "BEGIN_KEY\n";
+				out << "dst_name = " << key.dstHeader.name << "\n";
+				out << "dst_occ = " << key.dstHeader.occurrence << "\n";
+				out << "src_name = " << key.srcHeader.name << "\n";
+				out << "src_occ = " << key.srcHeader.occurrence << "\n";
+				out << "END_KEY\n";
+			}
 			out << "reverseKey = " << (rule.reverseKey ? 1 : 0) << "\n";
+			out << "key_trim = " << (rule.keyNormalization.trim ? 1 : 0) << "\n";
+			out << "key_caseFold = " << (rule.keyNormalization.caseFold ? 1 : 0) << "\n";
+			out << "key_numeric = " << (rule.keyNormalization.numeric ? 1 : 0) << "\n";
+			out << "key_stripLeadingZeros = " << (rule.keyNormalization.stripLeadingZeros ? 1 : 0) << "\n";
 			out << "mergeHeaders_count = " << rule.mergeHeaders.size() << "\n";
 			for (const auto& headers : rule.mergeHeaders) {
 				out << "BEGIN_HEADER\n";
@@ -339,6 +568,16 @@ void Project::save_all_mergesettings() const {
 				out << "src_occ = " << headers.srcHeader.occurrence << "\n";
 				out << "END_HEADER\n";
 			}
+			out << "ledger_count = " << rule.ledger.size() << "\n";
+			for (const auto& [file, entry] : rule.ledger) {
+				out << "BEGIN_LEDGER\n";
+				out << "path = " << file << "\n";
+				out << "size = " << entry.size << "\n";
+				out << "mtime = " << entry.mtime << "\n";
+				out << "hash = " << entry.hash << "\n";
+				out << "rows = " << entry.rows << "\n";
+				out << "END_LEDGER\n";
+			}
 			out << "END_RULE\n";
 		}
 		out << "END_PROFILE\n";
@@ -1050,7 +1289,7 @@ SaveReport save_sheet(const std::string& filePath, SheetTable& table, const Shee
 		{
 			for (std::size_t c = 0; c < table.columns.size(); ++c)
 			{
-				auto& cell = table.columns[c].values[r];
+				const auto& cell = table.columns[c].values[r];
 				xlnt::cell xcell = ws.cell(xlnt::cell_reference((int)(c + 1), (int)(excelDataStart + r)));
 				set_xlnt_cell_value(xcell, cell.first);
 			}
@@ -1077,8 +1316,322 @@ SaveReport save_sheet(const std::string& filePath, SheetTable& table, const Shee
 	}
 }
 
-MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& settings) {
+const char* diag_code_name(DiagCode code) {
+	switch (code) {
+	case DiagCode::DstHeaderNotFound:
+		return "DST_HEADER_NOT_FOUND";
+	case DiagCode::SrcHeaderNotFound:
+		return "SRC_HEADER_NOT_FOUND";
+	case DiagCode::DstKeyNotFound:
+		return "DST_KEY_NOT_FOUND";
+	case DiagCode::SrcKeyNotFound:
+		return "SRC_KEY_NOT_FOUND";
+	case DiagCode::StaleChangeSet:
+		return "STALE_CHANGE_SET";
+	case DiagCode::FileFailed:
+		return "FILE_FAILED";
+	}
+	return "UNKNOWN";
+}
+
+std::string diag_message(const Diagnostic& d) {
+	std::string msg;
+	if (!d.rule.empty())
+		msg += d.rule + ": ";
+	switch (d.code) {
+	case DiagCode::DstHeaderNotFound:
+		msg += "Destination Header not found: " + d.subject;
+		break;
+	case DiagCode::SrcHeaderNotFound:
+		msg += "Source Header not found: " + d.subject;
+		break;
+	case DiagCode::DstKeyNotFound:
+		msg += "Destination Key not found: " + d.subject;
+		break;
+	case DiagCode::SrcKeyNotFound:
+		msg += "Source Key not found: " + d.subject;
+		break;
+	case DiagCode::StaleChangeSet:
+		msg += "Destination changed since the dry run, merge it again: " + d.subject;
+		break;
+	case DiagCode::FileFailed:
+		msg += "Could not merge file: " + d.subject;
+		break;
+	}
+	if (!d.detail.empty())
+		msg += " (" + d.detail + ")";
+	if (d.count > 1)
+		msg += " [" + std::to_string(d.count) + " times]";
+	if (d.exampleRow >= 0)
+		msg += " [first in source row " + std::to_string(d.exampleRow + 1) + "]";
+	return msg;
+}
+
+void Diagnostics::add(DiagCode code, Severity severity, const std::string& subject, std::int64_t row, const std::string& detail) {
+	for (auto& d : items) {
+		if (d.code == code && d.rule.empty() && d.subject == subject) {
+			d.count++;
+			return;
+		}
+	}
+	items.push_back({ code, severity, "", subject, detail, 1, row });
+}
+
+void Diagnostics::merge(const Diagnostics& other, const std::string& rule) {
+	for (const auto& o : other.items) {
+		const std::string& r = o.rule.empty() ? rule : o.rule;
+		auto it = std::find_if(items.begin(), items.end(), [&](const Diagnostic& d) {
+			return d.code == o.code && d.rule == r && d.subject == o.subject;
+			});
+		if (it != items.end()) {
+			it->count += o.count;
+			continue;
+		}
+		items.push_back(o);
+		items.back().rule = r;
+	}
+}
+
+std::size_t Diagnostics::count(Severity severity) const {
+	return std::count_if(items.begin(), items.end(), [&](const Diagnostic& d) { return d.severity == severity; });
+}
+
+void log_diagnostics(const Diagnostics& diagnostics) {
+	for (const auto& d : diagnostics.items) {
+		if (d.severity == Severity::Error)
+			logging::logerror("[Merge Report] %s", diag_message(d).c_str());
+		else
+			logging::logwarning("[Merge Report] %s", diag_message(d).c_str());
+	}
+}
+
+MergeChangeSet DryRunMerge(const SheetTable& dst, const SheetTable& src, const MergeSettings& settings, MergeReport& report, MergeIndexCache* cache) {
+	MergeChangeSet changes;
+	changes.baseVersion = dst.version;
+	// Check if there is something to merge. Skip if there is none
+	if (!dst.loaded || !src.loaded)
+		return changes;
+	if (dst.columns.empty() || src.columns.empty())
+		return changes;
+	if (settings.mergeHeaders.empty() || !settings.useKey())
+		return changes;
+	// Collecting all key columns, a composite key needs every column on both sides
+	const std::vector<MergeHeaders> keys = settings.keyHeaders();
+	std::vector<const Column*> dstkeyCols;
+	std::vector<const Column*> srckeyCols;
+	bool keysFound = true;
+	for (const auto& key : keys) {
+		const Column* dstkeyCol = dst.find_column(key.dstHeader.name, key.dstHeader.occurrence);
+		const Column* srckeyCol = src.find_column(key.srcHeader.name, key.srcHeader.occurrence);
+		if (!dstkeyCol) {
+			report.diagnostics.add(DiagCode::DstKeyNotFound, Severity::Error, header_label(key.dstHeader));
+			keysFound = false;
+		}
+		if (!srckeyCol) {
+			report.diagnostics.add(DiagCode::SrcKeyNotFound, Severity::Error, header_label(key.srcHeader));
+			keysFound = false;
+		}
+		dstkeyCols.push_back(dstkeyCol);
+		srckeyCols.push_back(srckeyCol);
+	}
+	if (!keysFound)
+		return changes;
+	// Resolving the merge headers once
+	std::vector<const Column*> srcCols;
+	std::vector<const Column*> dstCols;
+	for (const auto& header : settings.mergeHeaders) {
+		srcCols.push_back(src.find_column(header.srcHeader.name, header.srcHeader.occurrence));
+		dstCols.push_back(dst.find_column(header.dstHeader.name, header.dstHeader.occurrence));
+	}
+	// Labels of missing headers, built once instead of per row
+	std::vector<std::string> dstLabels(settings.mergeHeaders.size());
+	std::vector<std::string> srcLabels(settings.mergeHeaders.size());
+	for (std::size_t h = 0; h < settings.mergeHeaders.size(); h++) {
+		if (!dstCols[h])
+			dstLabels[h] = header_label(settings.mergeHeaders[h].dstHeader);
+		if (!srcCols[h])
+			srcLabels[h] = header_label(settings.mergeHeaders[h].srcHeader);
+	}
+	auto header_found = [&](std::size_t h, std::size_t row) {
+		if (!dstCols[h]) {
+			report.diagnostics.add(DiagCode::DstHeaderNotFound, Severity::Warning, dstLabels[h], row);
+			report.conflicts++;
+		}
+		if (!srcCols[h]) {
+			report.diagnostics.add(DiagCode::SrcHeaderNotFound, Severity::Warning, srcLabels[h], row);
+			report.conflicts++;
+		}
+		if (!srcCols[h] || !dstCols[h]) {
+			report.skippedHeaders++;
+			return false;
+		}
+		return true;
+		};
+	auto col_id = [&](const Column* col) {
+		return static_cast<ColId>(col - dst.columns.data());
+		};
+	// Header h reads from sources[h], missing headers keep an empty column
+	for (const Column* col : srcCols) {
+		changes.sources.push_back(col ? col->values : decltype(Column::values){});
+	}
+
+	KeyView localKeys;
+	KeyView srcKeys;
+	srcKeys.build(srckeyCols, settings.keyNormalization);
+	// A shared index is only worth it for hash joins, the sort-merge join sorts both sides anyway
+	MergeIndexCache::Entry* shared = nullptr;
+	if (cache && choose_join_strategy(dst.rowCount) == JoinStrategy::Hash)
+		shared = &cache->get(dst, dstkeyCols, settings.keyNormalization);
+	else
+		localKeys.build(dstkeyCols, settings.keyNormalization);
+	const KeyView& dstKeys = shared ? shared->keys : localKeys;
+	const JoinStrategy strategy = shared ? JoinStrategy::Hash : choose_join_strategy(dstKeys.rows());
+	report.join = join_strategy_name(strategy);
+	auto match_keys = [&](bool markDuplicates) {
+		if (shared)
+			return MatchKeys(dstKeys, shared->index, srcKeys, markDuplicates);
+		return MatchKeys(dstKeys, srcKeys, markDuplicates, strategy);
+		};
+	// Merging only if value does not exist in header
+	if (settings.reverseKey) {
+		report.type = "None Matching Key";
+		// Appended keys count as existing if all key columns themselves are merged
+		bool keyMerged = true;
+		for (const auto& key : keys) {
+			bool merged = false;
+			for (const auto& header : settings.mergeHeaders) {
+				if (header.dstHeader.name == key.dstHeader.name && header.dstHeader.occurrence == key.dstHeader.occurrence &&
+					header.srcHeader.name == key.srcHeader.name && header.srcHeader.occurrence == key.srcHeader.occurrence)
+					merged = true;
+			}
+			keyMerged = keyMerged && merged;
+		}
+		const std::vector<std::uint32_t> matches = match_keys(keyMerged);
+		// Loop each row and insert the row into dst if they keys value does not alrdy exist in file
+		for (int i = 0; i < srcKeys.rows(); i++) {
+			if (srcKeys.empty(i))
+				continue;
+			if (matches[i] != NO_MATCH)
+				continue;
+			bool appended = false;
+			// Looping all headers
+			for (std::size_t h = 0; h < settings.mergeHeaders.size(); h++) {
+				if (!header_found(h, i))
+					continue;
+				if (!srcCols[h]->values[i].second.empty())
+					report.cellsWritten++;
+				appended = true;
+			}
+			if (appended) {
+				changes.appendRows.push_back((std::uint32_t)i);
+				changes.rowsAppended++;
+			}
+		}
+		// Headers that were not found append nothing, of several headers into the same column the last one wins
+		for (std::size_t h = 0; h < settings.mergeHeaders.size(); h++) {
+			bool overridden = false;
+			for (std::size_t later = h + 1; later < settings.mergeHeaders.size(); later++) {
+				overridden = overridden || (dstCols[h] && srcCols[later] && dstCols[later] == dstCols[h]);
+			}
+			if (srcCols[h] && dstCols[h] && !overridden) {
+				changes.appendColumns.push_back(col_id(dstCols[h]));
+				changes.appendSources.push_back((std::uint32_t)h);
+			}
+		}
+	}
+	// Merging only if value does exist in header
+	else {
+		report.type = "Matching Key";
+		const std::vector<std::uint32_t> matches = match_keys(false);
+		// Rows of each destination column written so far, a second write marks the cell for the conflict check
+		std::vector<std::vector<bool>> written(dst.columns.size());
+		std::vector<std::vector<bool>> repeated(dst.columns.size());
+		bool anyRepeated = false;
+		// Loop each row and insert the row into dst if the keys value does exist
+		for (int i = 0; i < srcKeys.rows(); i++) {
+			if (matches[i] == NO_MATCH)
+				continue;
+			// Looping all headers
+			for (std::size_t h = 0; h < settings.mergeHeaders.size(); h++) {
+				if (!header_found(h, i))
+					continue;
+				const auto& value = srcCols[h]->values[i];
+				const ColId col = col_id(dstCols[h]);
+				const std::uint32_t row = matches[i];
+				const auto& current = dstCols[h]->values[row];
+				if (!std::holds_alternative<std::monostate>(current.first) && !(current.first == value.first))
+					changes.cellsOverwritten++;
+				if (written[col].empty())
+					written[col].resize(dstCols[h]->values.size());
+				if (written[col][row]) {
+					if (repeated[col].empty())
+						repeated[col].resize(dstCols[h]->values.size());
+					repeated[col][row] = true;
+					anyRepeated = true;
+				}
+				written[col][row] = true;
+				changes.cells.push_back({ col, row, (std::uint32_t)h, (std::uint32_t)i });
+				if (!value.second.empty())
+					report.cellsWritten++;
+			}
+			changes.rowsMatched++;
+			report.rowsMatched++;
+			report.rowsWritten++;
+		}
+		// Only the writes of repeated cells are compared, in write order per cell
+		if (anyRepeated) {
+			std::vector<std::uint32_t> writes;
+			for (std::uint32_t c = 0; c < changes.cells.size(); c++) {
+				const auto& change = changes.cells[c];
+				if (!repeated[change.column].empty() && repeated[change.column][change.row])
+					writes.push_back(c);
+			}
+			std::stable_sort(writes.begin(), writes.end(), [&](std::uint32_t a, std::uint32_t b) {
+				const auto& x = changes.cells[a];
+				const auto& y = changes.cells[b];
+				return x.column != y.column ? x.column < y.column : x.row < y.row;
+				});
+			for (std::size_t w = 1; w < writes.size(); w++) {
+				const auto& previous = changes.cells[writes[w - 1]];
+				const auto& change = changes.cells[writes[w]];
+				if (previous.column == change.column && previous.row == change.row && !(changes.value(previous).first == changes.value(change).first))
+					changes.cellsConflicting++;
+			}
+		}
+	}
+	return changes;
+}
+
+bool ApplyChangeSet(SheetTable& dst, MergeChangeSet& changes, MergeReport& report) {
+	if (!changes.current(dst)) {
+		report.diagnostics.add(DiagCode::StaleChangeSet, Severity::Error, dst.name);
+		return false;
+	}
+	for (const auto& change : changes.cells) {
+		dst.columns[change.column].values.edit(change.row) = changes.value(change);
+	}
+	for (std::size_t k = 0; k < changes.appendColumns.size(); k++) {
+		auto& values = dst.columns[changes.appendColumns[k]].values;
+		const auto& source = changes.sources[changes.appendSources[k]];
+		for (const std::uint32_t row : changes.appendRows) {
+			values.push_back(source[row]);
+		}
+	}
+	// Keeping the table rectangular
+	dst.rowCount += changes.rowsAppended;
+	for (auto& col : dst.columns) {
+		if (col.values.size() < dst.rowCount)
+			col.values.append_fill(dst.rowCount - col.values.size(), { std::monostate{}, "" });
+	}
+	report.rowsAppended += changes.rowsAppended;
+	dst.touch();
+	changes = {};
+	return true;
+}
+
+MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& settings, MergeIndexCache* cache) {
 	MergeReport report;
+	report.rule = settings.name;
 	Timer t;
 	// Check if there is something to merge. Skip if there is none
 	if (!dst.loaded || !src.loaded)
@@ -1089,124 +1642,60 @@ MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& s
 		return report;
 	t.Start();
 	int startCount = dst.rowCount;
-	const bool useKey = (!settings.key.dstHeader.name.empty() && !settings.key.srcHeader.name.empty());
-	if (useKey) {
-		// Merging only if value does not exist in header
-		Column* dstkeyCol = dst.find_column(settings.key.dstHeader.name, settings.key.dstHeader.occurrence);
-		Column* srckeyCol = src.find_column(settings.key.srcHeader.name, settings.key.srcHeader.occurrence);
-		if (dstkeyCol && srckeyCol) {
-			if (settings.reverseKey) {
-				report.type = "None Matching Key";
-				// Loop each row and insert the row into dst if they keys value does not alrdy exist in file
-				for (int i = 0; i < srckeyCol->values.size(); i++) {
-					const std::pair<ExcelValue, std::string> value = srckeyCol->values[i];
-					if (std::holds_alternative<std::monostate>(value.first))
-						continue;
-					auto it = std::find(dstkeyCol->values.begin(), dstkeyCol->values.end(), value);
-					if (it != dstkeyCol->values.end())
-						continue;
-					// Looping all headers
-					for (const auto& header : settings.mergeHeaders) {
-						Column* dstCol = dst.find_column(header.dstHeader.name, header.dstHeader.occurrence);
-						if (!dstCol) {
-							report.warnings.push_back("Destination Header not found: " + header_label(header.dstHeader));
-							report.conflicts++;
-						}
-						Column* srcCol = src.find_column(header.srcHeader.name, header.srcHeader.occurrence);
-						if (!srcCol) {
-							report.warnings.push_back("Source Header not found: " + header_label(header.srcHeader));
-							report.conflicts++;
-						}
-						if (!srcCol || !dstCol) {
-							report.skippedHeaders++;
-							continue;
-						}
-						// inserting the value
-						dstCol->values.emplace_back(srcCol->values[i]);
-						if (dstCol->values.size() > dst.rowCount)
-							dst.rowCount = dstCol->values.size() + 1;
-						if (!srcCol->values[i].second.empty())
-							report.cellsWritten++;
-					}
-				}
-			}
-			// Merging only if value does exist in header
-			else {
-				report.type = "Matching Key";
-				// Loop each row and insert the row into dst if the keys value does exist
-				for (int i = 0; i < srckeyCol->values.size(); i++) {
-					const std::pair<ExcelValue, std::string> value = srckeyCol->values[i];
-					auto it = std::find(dstkeyCol->values.begin(), dstkeyCol->values.end(), value);
-					if (it == dstkeyCol->values.end())
-						continue;
-					// Looping all headers
-					for (const auto& header : settings.mergeHeaders) {
-						Column* dstCol = dst.find_column(header.dstHeader.name, header.dstHeader.occurrence);
-						if (!dstCol) {
-							report.warnings.push_back("Destination Header not found: " + header_label(header.dstHeader));
-							report.conflicts++;
-						}
-						Column* srcCol = src.find_column(header.srcHeader.name, header.srcHeader.occurrence);
-						if (!srcCol) {
-							report.warnings.push_back("Source Header not found: " + header_label(header.srcHeader));
-							report.conflicts++;
-						}
-						if (!srcCol || !dstCol) {
-							report.skippedHeaders++;
-							continue;
-						}
-						// inserting the value inside the row
-						dstCol->values[it - dstkeyCol->values.begin()] = srcCol->values[i];
-						if (!srcCol->values[i].second.empty())
-							report.cellsWritten++;
-					}
-					report.rowsMatched++;
-					report.rowsWritten++;
-				}
-			}
-		}
-		else {
-			if (!dstkeyCol) {
-				report.errors.push_back("Destination Key not found: " + header_label(settings.key.dstHeader));
-			}
-			if (!srckeyCol) {
-				report.errors.push_back("Source Key not found: " + header_label(settings.key.srcHeader));
-			}
+	if (settings.useKey()) {
+		MergeChangeSet changes = DryRunMerge(dst, src, settings, report, cache);
+		// Key cells of existing rows that change invalidate shared indexes over them
+		std::vector<ColId> overwritten;
+		for (const auto& change : changes.cells) {
+			if (std::find(overwritten.begin(), overwritten.end(), change.column) == overwritten.end())
+				overwritten.push_back(change.column);
 		}
+		ApplyChangeSet(dst, changes, report);
+		if (cache)
+			cache->update(overwritten);
 	}
 	// Merging in append mode
 	else {
 		report.type = "Append";
+		const std::size_t startRows = dst.rowCount;
+		const std::pair<ExcelValue, std::string> empty = { std::monostate{}, "" };
 		// looping all merge header rules
 		for (const auto& header : settings.mergeHeaders) {
 			Column* dstCol = dst.find_column(header.dstHeader.name, header.dstHeader.occurrence);
 			if (!dstCol) {
-				report.warnings.push_back("Destination Header not found: " + header_label(header.dstHeader));
+				report.diagnostics.add(DiagCode::DstHeaderNotFound, Severity::Warning, header_label(header.dstHeader));
 				report.conflicts++;
 			}
 			Column* srcCol = src.find_column(header.srcHeader.name, header.srcHeader.occurrence);
 			if (!srcCol) {
-				report.warnings.push_back("Source Header not found: " + header_label(header.srcHeader));
+				report.diagnostics.add(DiagCode::SrcHeaderNotFound, Severity::Warning, header_label(header.srcHeader));
 				report.conflicts++;
 			}
 			if (!srcCol || !dstCol) {
 				report.skippedHeaders++;
 				continue;
 			}
+			// Whole column at once, the source rows start below the existing rows.
+			// Of several headers into the same column the last one wins.
+			dstCol->values.truncate(startRows);
+			if (dstCol->values.size() < startRows)
+				dstCol->values.append_fill(startRows - dstCol->values.size(), empty);
+			dstCol->values.append(srcCol->values);
 			for (const auto& value : srcCol->values) {
-				dstCol->values.emplace_back(std::move(value));
 				if (!value.second.empty())
 					report.cellsWritten++;
-				if (dstCol->values.size() > dst.rowCount)
-					dst.rowCount = dstCol->values.size() + 1;
 			}
+			dst.rowCount = std::max(dst.rowCount, dstCol->values.size());
 			report.rowsMatched++;
 		}
-	}
-	for (auto& col : dst.columns) {
-		while (col.values.size() < dst.rowCount - 1) {
-			col.values.emplace_back(std::monostate{}, "");
+		// Keeping the table rectangular
+		for (auto& col : dst.columns) {
+			if (col.values.size() < dst.rowCount)
+				col.values.append_fill(dst.rowCount - col.values.size(), empty);
 		}
+		dst.touch();
+		if (cache)
+			cache->update({});
 	}
 	report.rowsAppended = dst.rowCount - startCount;
 	t.Stop();
@@ -1216,6 +1705,7 @@ MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& s
 					Time:\t\t\t%.2fms (%.2fS)\n\
 					MergeReport:\n\
 							Merging Type:\t\t%s\n\
+							Join:\t\t\t\t%s\n\
 							Rows read:\t\t\t%zu\n\
 							Rows written:\t\t %zu\n\
 							Cells written:\t\t%zu\n\
@@ -1229,6 +1719,7 @@ MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& s
 		src.name.c_str(),
 		t.GetElapsedMilliseconds(), t.GetElapsedSeconds(),
 		report.type.c_str(),
+		report.join.c_str(),
 		report.rowsRead,
 		report.rowsWritten,
 		report.cellsWritten,
@@ -1236,7 +1727,152 @@ MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& s
 		report.rowsMatched,
 		report.conflicts,
 		report.skippedHeaders,
-		report.warnings.size(),
-		report.errors.size());
+		report.diagnostics.count(Severity::Warning),
+		report.diagnostics.count(Severity::Error));
 	return report;
 }
+
+std::vector<MergeReport> MergeFolder(SheetTable& dst, MergeSettings& settings, bool fullRebuild, MergeIndexCache* cache) {
+	std::vector<MergeReport> reports;
+	if (settings.mergefolder.empty())
+		return reports;
+	Timer t;
+	t.Start();
+	if (fullRebuild)
+		settings.pendingLedger.clear();
+	std::size_t skipped = 0;
+	const std::vector<std::string> files = fl::iteratePath(settings.mergefolder, false);
+	for (const std::string& file : files) {
+		std::string f = file;
+		std::transform(f.begin(), f.end(), f.begin(), ::tolower);
+		if (!f.ends_with(".xlsx") && !f.ends_with(".csv"))
+			continue;
+		MergeLedgerEntry entry;
+		entry.size = fl::filesize(file);
+		entry.mtime = fl::GetLastWriteTicks(file);
+		if (!fullRebuild) {
+			// Files merged in this session take precedence over the saved ledger
+			MergeLedgerEntry* known = nullptr;
+			auto pit = settings.pendingLedger.find(file);
+			if (pit != settings.pendingLedger.end()) {
+				known = &pit->second;
+			}
+			else {
+				auto lit = settings.ledger.find(file);
+				if (lit != settings.ledger.end())
+					known = &lit->second;
+			}
+			if (known && known->size == entry.size && known->mtime == entry.mtime) {
+				skipped++;
+				continue;
+			}
+			entry.hash = fl::hashfile(file);
+			// Only touched but content is the same
+			if (known && known->size == entry.size && known->hash == entry.hash) {
+				known->mtime = entry.mtime;
+				skipped++;
+				continue;
+			}
+		}
+		else {
+			entry.hash = fl::hashfile(file);
+		}
+		try {
+			SheetTable srcTable = load_sheet(file, settings.sourceFile.activeSheet, settings.sheetSettings);
+			MergeReport report = MergeTables(dst, srcTable, settings, cache);
+			entry.rows = report.rowsAppended + report.rowsWritten;
+			if (!report.diagnostics.hasErrors())
+				settings.pendingLedger[file] = entry;
+			reports.push_back(std::move(report));
+		}
+		catch (const std::exception& e) {
+			MergeReport report;
+			report.rule = settings.name;
+			report.diagnostics.add(DiagCode::FileFailed, Severity::Error, file, -1, e.what());
+			reports.push_back(std::move(report));
+		}
+	}
+	t.Stop();
+	logging::loginfo("[project::MergeFolder] Mergefolder processed:\n\
+					Folder:\t\t%s\n\
+					Merged files:\t%zu\n\
+					Skipped files:\t%zu (already merged)\n\
+					Time:\t\t\t%.2fms (%.2fS)",
+		settings.mergefolder.c_str(),
+		reports.size(),
+		skipped,
+		t.GetElapsedMilliseconds(), t.GetElapsedSeconds());
+	return reports;
+}
+
+// Adds the counters and messages of part to total
+static void add_report(MergeReport& total, const MergeReport& part) {
+	total.rowsRead += part.rowsRead;
+	total.rowsWritten += part.rowsWritten;
+	total.cellsWritten += part.cellsWritten;
+	total.rowsAppended += part.rowsAppended;
+	total.rowsMatched += part.rowsMatched;
+	total.conflicts += part.conflicts;
+	total.skippedHeaders += part.skippedHeaders;
+	total.diagnostics.merge(part.diagnostics, part.rule);
+}
+
+MergeReport MergeProfile(SheetTable& dst, std::vector<MergeSettings>& rules, bool fullRebuild) {
+	MergeReport total;
+	total.type = "Profile";
+	Timer t;
+	t.Start();
+	MergeIndexCache cache;
+	for (auto& settings : rules) {
+		if (!settings.sourceFile.loaded)
+			continue;
+		MergeReport report;
+		if (settings.mergefolder.empty()) {
+			report = MergeTables(dst, settings.sourceFile, settings, &cache);
+		}
+		else {
+			// One report per rule, the files of a mergefolder are summed up
+			report.rule = settings.name;
+			report.type = "Mergefolder";
+			for (const auto& part : MergeFolder(dst, settings, fullRebuild, &cache)) {
+				add_report(report, part);
+				if (report.join.empty())
+					report.join = part.join;
+			}
+		}
+		add_report(total, report);
+		total.rules.push_back(std::move(report));
+	}
+	total.keyIndexes = cache.entries.size();
+	total.indexesReused = cache.reused;
+	// The strategy all key rules used, empty if they differ
+	for (const auto& report : total.rules) {
+		if (report.join.empty())
+			continue;
+		if (total.join.empty())
+			total.join = report.join;
+		else if (total.join != report.join) {
+			total.join.clear();
+			break;
+		}
+	}
+	t.Stop();
+	logging::loginfo("[project::MergeProfile] Rules merged:\n\
+					Destination:\t%s\n\
+					Rules:\t\t\t%zu\n\
+					Key indexes:\t%zu, %zu reused\n\
+					Time:\t\t\t%.2fms (%.2fS)\n\
+					Rows appended:\t%zu\n\
+					Rows matched:\t%zu\n\
+					Warnings:\t\t%zu\n\
+					Errors:\t\t\t%zu",
+		dst.name.c_str(),
+		total.rules.size(),
+		total.keyIndexes, total.indexesReused,
+		t.GetElapsedMilliseconds(), t.GetElapsedSeconds(),
+		total.rowsAppended,
+		total.rowsMatched,
+		total.diagnostics.count(Severity::Warning),
+		total.diagnostics.count(Severity::Error));
+	return total;
+}
@@ -4,7 +4,9 @@
 #include <xlnt/xlnt.hpp>
 #include <variant>
 #include <cstdint>
+#include <unordered_map>
 #include "utils.h"
+#include "chunkedvector.h"
 
 /*struct ExcelDateTime {
 	int year, month, day;
@@ -17,23 +19,6 @@
 		return this != &rhs;
 	}
 };*/
-static std::string ExcelSerialToDate(int serial) {
-	int l = serial + 68569 + 2415019;
-	int n = 4 * l / 146097;
-	l = l - (146097 * n + 3) / 4;
-	int i = 4000 * (l + 1) / 1461001;
-	l = l - 1461 * i / 4 + 31;
-	int j = 80 * l / 2447;
-	int day = l - 2447 * j / 80;
-	l = j / 11;
-	int month = j + 2 - 12 * l;
-	int year = 100 * (n - 49) + i + l;
-
-	std::ostringstream oss;
-	oss << std::setfill('0') << std::setw(2) << day << "." << std::setw(2) << month << "." << year;
-	return oss.str();
-}
-
 using ExcelValue = std::variant<
 	std::monostate, // empty
 	double,					// numbers
@@ -147,17 +132,32 @@ struct CellKeyHash {
 	}
 };
 
+struct ColumnStats;
+
 struct Column {
 	HeaderKey key;
-	std::vector<std::pair<ExcelValue, std::string>> values;
+	ChunkedVector<std::pair<ExcelValue, std::string>> values;	// copies share unchanged chunks
+	mutable std::shared_ptr<const ColumnStats> stats{};	// cache of GetColumnStats, see columnstats.h
+	// Cache of column_label and column_id, built again once key differs from labelKey
+	mutable std::string label{};
+	mutable std::uint32_t labelId = 0;
+	mutable HeaderKey labelKey{ "", UINT32_MAX };
 };
 
+// header_label(column.key) without building it every frame, not thread safe
+const std::string& column_label(const Column& column);
+// Id of the column for ImGui, stays the same as long as its label does
+std::uint32_t column_id(const Column& column);
+
 struct SheetSettings {
 	// Data settings
 	int dataRow = -1;	// header row
 	bool stopAtEmpty = false;	// stop if row is empty
 };
 
+// Unique version numbers for SheetTable, never 0
+std::uint64_t next_table_version();
+
 struct SheetTable {
 public:
 	std::string name;
@@ -168,7 +168,10 @@ public:
 	std::vector<Column> columns;
 	std::unordered_map<std::string, std::vector<ColId>> byName;
 	bool loaded = false;
+	std::uint64_t version = next_table_version();	// changes with every edit so views can cache what they derive from the table
 	void clear();
+	// Call after changing the table
+	void touch() { version = next_table_version(); }
 
 	Column* find_column(const std::string& header, std::uint32_t occurrence = 0){
 		auto it = byName.find(header);
@@ -177,6 +180,9 @@ public:
 
 		return &columns[it->second[occurrence]];
 	}
+	const Column* find_column(const std::string& header, std::uint32_t occurrence = 0) const {
+		return const_cast<SheetTable*>(this)->find_column(header, occurrence);
+	}
 };
 
 struct MergeHeaders {
@@ -184,14 +190,78 @@ struct MergeHeaders {
 	HeaderKey dstHeader;
 };
 
+// How key values are compared, with everything off the values have to be equal
+struct KeyNormalization {
+	bool trim = false;	// ignore surrounding whitespace
+	bool caseFold = false;	// ignore upper/lower case
+	bool numeric = false;	// decimal numbers stored as text match numbers ("421,0" == 421), hex, inf and nan stay text
+	bool stripLeadingZeros = false;	// "0421" == "421", otherwise numbers with leading zeros stay text
+
+	bool active() const { return trim || caseFold || numeric || stripLeadingZeros; }
+	bool operator==(const KeyNormalization&) const = default;
+};
+
+// Remembers a file that was already merged from a mergefolder
+struct MergeLedgerEntry {
+	std::uintmax_t size = 0;
+	std::int64_t mtime = 0;
+	std::uint64_t hash = 0;	// content hash, only compared if size or mtime changed
+	std::size_t rows = 0;	// rows contributed by the file
+};
+
 struct MergeSettings {
 	std::string name;
 	std::string mergefolder = "";
+	std::unordered_map<std::string, MergeLedgerEntry> ledger;	// files of mergefolder already merged and saved
+	std::unordered_map<std::string, MergeLedgerEntry> pendingLedger;	// files merged into activeFile that is not saved yet
 	SheetTable sourceFile = {};
 	SheetSettings sheetSettings = {};
 	MergeHeaders key = {};	// used to only fill row if the key matches
+	std::vector<MergeHeaders> extraKeys;	// further key columns, the key matches only if all columns match
+	KeyNormalization keyNormalization = {};
 	bool reverseKey = false;	// used to reverse the key so only import if key is not present
 	std::vector<MergeHeaders> mergeHeaders;
+
+	bool useKey() const {
+		return !key.dstHeader.name.empty() && !key.srcHeader.name.empty();
+	}
+	// key followed by all extraKeys that are set
+	std::vector<MergeHeaders> keyHeaders() const {
+		std::vector<MergeHeaders> keys;
+		if (!useKey())
+			return keys;
+		keys.push_back(key);
+		for (const auto& k : extraKeys) {
+			if (!k.dstHeader.name.empty() && !k.srcHeader.name.empty())
+				keys.push_back(k);
+		}
+		return keys;
+	}
+};
+
+// State of the active file before a change, restored by undo/redo
+struct TableSnapshot {
+	std::string label;	// what the change was, shown on the undo/redo buttons
+	std::size_t rowCount = 0;
+	std::vector<Column> columns;	// shares every chunk the change did not touch
+	std::unordered_map<std::string, std::vector<ColId>> byName;
+	std::unordered_map<std::string, std::unordered_map<std::string, MergeLedgerEntry>> pendingLedgers;	// by merge setting name
+};
+
+struct TableHistory {
+	std::vector<TableSnapshot> undoStack;
+	std::vector<TableSnapshot> redoStack;
+	std::size_t memoryLimit = 512ull * 1024 * 1024;	// bytes held only by snapshots, oldest steps are dropped above it
+	std::size_t maxSteps = 100;
+
+	void clear() {
+		undoStack.clear();
+		redoStack.clear();
+	}
+	// Approximate bytes of all chunks the snapshots do not share with table
+	std::size_t memoryUsage(const SheetTable& table) const;
+	// Drops the oldest steps until maxSteps and memoryLimit are kept
+	void trim(const SheetTable& table);
 };
 
 struct Project {
@@ -201,6 +271,7 @@ struct Project {
 	std::unordered_map<std::string, SheetSettings> sheetSettings;
 	std::unordered_map<std::string, std::vector<MergeSettings>> mergeSettings;
 	SheetTable activeFile;
+	TableHistory history;	// undo/redo of activeFile
 	bool loaded = false;
 
 	void load(const std::string& name, const std::string& path);
@@ -209,6 +280,11 @@ struct Project {
 	void removefile(const std::string& path);
 	void clear();
 	void save();
+	void commitMergeLedgers();
+	// Call before changing activeFile, label is shown on the undo button
+	void snapshot(const std::string& label);
+	bool undo();
+	bool redo();
 	SheetSettings* getCurrentSettingsHandle() {
 		return &sheetSettings[sheet_key(activeFile.path, activeFile.activeSheet)];
 	}
@@ -239,8 +315,53 @@ struct SaveReport {
 
 SaveReport save_sheet(const std::string& filePath, SheetTable& table, const SheetSettings& ss);
 
+enum class DiagCode {
+	DstHeaderNotFound,
+	SrcHeaderNotFound,
+	DstKeyNotFound,
+	SrcKeyNotFound,
+	StaleChangeSet,	// destination changed since the dry run
+	FileFailed	// a mergefolder file could not be loaded or merged
+};
+
+enum class Severity {
+	Warning,
+	Error
+};
+
+// One distinct issue of a merge with the number of times it occurred
+struct Diagnostic {
+	DiagCode code;
+	Severity severity;
+	std::string rule;	// merge setting it occurred in
+	std::string subject;	// header, key or file
+	std::string detail;	// e.g. the exception text
+	std::size_t count = 0;
+	std::int64_t exampleRow = -1;	// first source row it occurred in, -1 if not row related
+};
+
+const char* diag_code_name(DiagCode code);
+std::string diag_message(const Diagnostic& d);
+
+// Collects diagnostics deduplicated by code, rule and subject, so per row issues cost one entry
+struct Diagnostics {
+	std::vector<Diagnostic> items;
+
+	void add(DiagCode code, Severity severity, const std::string& subject, std::int64_t row = -1, const std::string& detail = "");
+	// Adds all of other, entries without a rule get rule
+	void merge(const Diagnostics& other, const std::string& rule = "");
+	std::size_t count(Severity severity) const;	// distinct issues
+	bool hasErrors() const { return count(Severity::Error) > 0; }
+	bool empty() const { return items.empty(); }
+};
+
+// Logs every distinct issue once
+void log_diagnostics(const Diagnostics& diagnostics);
+
 struct MergeReport {
+	std::string rule = "";	// name of the merge setting
 	std::string type = "";
+	std::string join = "";	// key matching strategy, empty in append mode
 	size_t rowsRead = 0;
 	size_t rowsWritten = 0;
 	size_t cellsWritten = 0;
@@ -248,8 +369,47 @@ struct MergeReport {
 	size_t rowsMatched = 0;
 	size_t conflicts = 0;
 	size_t skippedHeaders = 0;
-	std::vector<std::string> warnings;
-	std::vector<std::string> errors;
+	size_t keyIndexes = 0;	// destination key indexes a MergeProfile run built
+	size_t indexesReused = 0;	// lookups of a MergeProfile run served by one of them
+	Diagnostics diagnostics;
+	std::vector<MergeReport> rules;	// per rule reports of a MergeProfile run
 };
 
-MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& settings);
+// Changes a key merge would make to the destination, computed without touching it.
+// Cells refer to the source columns instead of holding values, the copies of the columns share their chunks.
+struct MergeChangeSet {
+	struct CellChange {
+		ColId column;
+		std::uint32_t row;
+		std::uint32_t source;	// index into sources
+		std::uint32_t sourceRow;
+	};
+	std::uint64_t baseVersion = 0;	// destination version the change set was computed for
+	std::vector<decltype(Column::values)> sources;	// source column of each merge header
+	std::vector<CellChange> cells;	// values written into existing rows, later changes win
+	std::vector<ColId> appendColumns;	// destination column of each appendSources entry
+	std::vector<std::uint32_t> appendSources;	// index into sources
+	std::vector<std::uint32_t> appendRows;	// source rows appended, the same for every append column
+	std::size_t rowsMatched = 0;
+	std::size_t rowsAppended = 0;
+	std::size_t cellsOverwritten = 0;	// non-empty destination cells that get a different value
+	std::size_t cellsConflicting = 0;	// cells written by several source rows with different values
+
+	bool empty() const { return cells.empty() && rowsAppended == 0; }
+	bool current(const SheetTable& dst) const { return dst.version == baseVersion; }
+	const std::pair<ExcelValue, std::string>& value(const CellChange& change) const { return sources[change.source][change.sourceRow]; }
+};
+
+struct MergeIndexCache;	// merge.h
+
+// cache shares destination key indexes with other merges of the same run, optional
+MergeReport MergeTables(SheetTable& dst, SheetTable& src, const MergeSettings& settings, MergeIndexCache* cache = nullptr);
+// Key merges only, append merges have nothing to preview
+MergeChangeSet DryRunMerge(const SheetTable& dst, const SheetTable& src, const MergeSettings& settings, MergeReport& report, MergeIndexCache* cache = nullptr);
+// Applies in O(changes) and consumes the change set. Fails if dst changed since the dry run.
+bool ApplyChangeSet(SheetTable& dst, MergeChangeSet& changes, MergeReport& report);
+// Merges every file of settings.mergefolder that is not in the ledger yet (or changed since)
+std::vector<MergeReport> MergeFolder(SheetTable& dst, MergeSettings& settings, bool fullRebuild = false, MergeIndexCache* cache = nullptr);
+// Runs all rules of a sheet in order. Rules sharing destination key columns share one key index.
+// Returns the sums of all rules, with the report of every rule in rules.
+MergeReport MergeProfile(SheetTable& dst, std::vector<MergeSettings>& rules, bool fullRebuild = false);
@@ -0,0 +1,23 @@
+#include "redraw.h"
+#include <condition_variable>
+#include <mutex>
+
+static std::mutex mutex;
+static std::condition_variable wakeup;
+static bool requested = false;
+
+void RequestRedraw() {
+	{
+		std::lock_guard lock(mutex);
+		requested = true;
+	}
+	wakeup.notify_one();
+}
+
+bool WaitForRedraw(std::chrono::milliseconds timeout) {
+	std::unique_lock lock(mutex);
+	wakeup.wait_for(lock, timeout, []() { return requested; });
+	const bool result = requested;
+	requested = false;
+	return result;
+}
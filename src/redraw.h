@@ -0,0 +1,8 @@
+#pragma once
+#include <chrono>
+
+// The UI only draws while something happens. Anything that changes what it shows outside of input,
+// e.g. a finished worker or a new log message, asks for a redraw here. Safe to call from any thread.
+void RequestRedraw();
+// Sleeps until a redraw was requested or timeout passed, returns true if one was requested and clears it
+bool WaitForRedraw(std::chrono::milliseconds timeout);
@@ -0,0 +1,22 @@
+#pragma once
+#include <chrono>
+#include <future>
+#include <vector>
+
+// Outdated background jobs that are still running.
+// The future of std::async waits for its job when it is destroyed, parking it here lets the UI thread go on
+// while a cancelled job winds down. poll() drops the finished ones, call it whenever the owner updates.
+template <typename T>
+struct RetiredJobs {
+	std::vector<std::future<T>> jobs;
+
+	void add(std::future<T>&& job) {
+		if (job.valid())
+			jobs.push_back(std::move(job));
+	}
+	void poll() {
+		std::erase_if(jobs, [](const std::future<T>& job) {
+			return job.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+			});
+	}
+};
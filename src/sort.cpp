@@ -0,0 +1,170 @@
+#include "sort.h"
+#include "parallelsort.h"
+#include "redraw.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <string>
+
+namespace {
+// Sortable form of a cell, extracted once so comparisons do not visit the variant
+struct SortValue {
+	enum Class : std::uint8_t { Number, Text, Empty };
+	Class cls = Empty;
+	double number = 0.0;
+	std::uint64_t prefix = 0;	// first 8 bytes of text, most comparisons end here without touching the string
+	const std::string* text = nullptr;	// points into the column chunks, the table outlives the sort
+};
+}
+
+static SortValue sort_value(const std::pair<ExcelValue, std::string>& cell) {
+	SortValue v;
+	if (const auto* i = std::get_if<std::int64_t>(&cell.first)) {
+		v.cls = SortValue::Number;
+		v.number = (double)*i;
+	}
+	else if (const auto* d = std::get_if<double>(&cell.first)) {
+		// NaN is not ordered against any number, it sorts with the empty cells
+		v.cls = std::isnan(*d) ? SortValue::Empty : SortValue::Number;
+		v.number = *d;
+	}
+	else if (const auto* b = std::get_if<bool>(&cell.first)) {
+		v.cls = SortValue::Number;
+		v.number = *b ? 1.0 : 0.0;
+	}
+	else if (!cell.second.empty()) {
+		v.cls = SortValue::Text;
+		v.text = &cell.second;
+		for (std::size_t i = 0; i < 8; ++i) {
+			v.prefix = v.prefix << 8 | (i < cell.second.size() ? (unsigned char)cell.second[i] : 0);
+		}
+	}
+	return v;
+}
+
+// <0, 0 or >0 like strcmp, descending only flips values, empty cells stay last
+static int compare(const SortValue& a, const SortValue& b, bool descending) {
+	if (a.cls != b.cls) {
+		if (a.cls == SortValue::Empty || b.cls == SortValue::Empty)
+			return a.cls == SortValue::Empty ? 1 : -1;
+		return (a.cls < b.cls) != descending ? -1 : 1;
+	}
+	int result = 0;
+	if (a.cls == SortValue::Number)
+		result = a.number < b.number ? -1 : (b.number < a.number ? 1 : 0);
+	else if (a.cls == SortValue::Text)
+		result = a.prefix != b.prefix ? (a.prefix < b.prefix ? -1 : 1) : a.text->compare(*b.text);
+	return descending ? -result : result;
+}
+
+std::vector<int> SortRows(const SheetTable& table, const std::vector<SortKey>& keys, const std::atomic<bool>* cancel) {
+	std::vector<SortKey> used;
+	std::vector<std::vector<SortValue>> values;
+	for (const SortKey& key : keys) {
+		if (key.column >= (ColId)table.columns.size())
+			continue;
+		used.push_back(key);
+		auto& v = values.emplace_back(table.rowCount);
+		const auto& column = table.columns[key.column].values;
+		for (std::size_t c = 0; c < column.chunk_count(); ++c) {
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				return {};
+			const std::size_t begin = c * column.CHUNK_SIZE;
+			const auto& chunk = *column.chunk(c);
+			for (std::size_t r = 0; r < chunk.size() && begin + r < table.rowCount; ++r) {
+				v[begin + r] = sort_value(chunk[r]);
+			}
+		}
+	}
+	if (used.empty()) {
+		std::vector<int> order(table.rowCount);
+		std::iota(order.begin(), order.end(), 0);
+		return order;
+	}
+	// The first key is sorted inline, later keys are only looked up for ties
+	struct Item {
+		SortValue first;
+		int row;
+	};
+	std::vector<Item> items(table.rowCount);
+	for (std::size_t r = 0; r < items.size(); ++r) {
+		items[r] = { values[0][r], (int)r };
+	}
+	// The row breaks ties, that makes the parallel sort stable
+	ParallelSort(items.begin(), items.end(), [&](const Item& a, const Item& b) {
+		int result = compare(a.first, b.first, used[0].descending);
+		for (std::size_t k = 1; k < used.size() && result == 0; ++k) {
+			result = compare(values[k][a.row], values[k][b.row], used[k].descending);
+		}
+		return result != 0 ? result < 0 : a.row < b.row;
+		});
+	if (cancel && cancel->load(std::memory_order_relaxed))
+		return {};
+	std::vector<int> order(items.size());
+	for (std::size_t i = 0; i < items.size(); ++i) {
+		order[i] = items[i].row;
+	}
+	return order;
+}
+
+std::vector<int> OrderRows(const std::vector<int>& order, const std::vector<int>& rows) {
+	if (rows.empty())
+		return {};
+	std::vector<bool> wanted(std::max<std::size_t>(order.size(), rows.back() + 1));
+	for (const int r : rows) {
+		wanted[r] = true;
+	}
+	std::vector<int> out;
+	out.reserve(rows.size());
+	for (const int r : order) {
+		if ((std::size_t)r < wanted.size() && wanted[r]) {
+			out.push_back(r);
+			wanted[r] = false;
+		}
+	}
+	// Rows the order does not know yet, e.g. appended while it was sorted
+	for (const int r : rows) {
+		if (wanted[r])
+			out.push_back(r);
+	}
+	return out;
+}
+
+bool SortCache::update(const SheetTable& table, const std::vector<SortKey>& keys) {
+	Input next{ keys, table.version };
+	if (generation == 0 || !(next == wanted)) {
+		wanted = std::move(next);
+		generation++;
+		// The running job is outdated now, stopping it instead of waiting for a result that gets dropped
+		if (job.valid()) {
+			cancel->store(true);
+			retired.add(std::move(job));
+			job = {};
+		}
+	}
+	retired.poll();
+	bool changed = false;
+	if (job.valid() && job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		order = job.get();
+		orderGeneration = jobGeneration;
+		changed = true;
+	}
+	// Up to date or still running
+	if (orderGeneration == generation || job.valid())
+		return changed;
+	if (keys.empty() || table.rowCount < SORT_ASYNC_ROWS) {
+		order = keys.empty() ? std::vector<int>{} : SortRows(table, keys);
+		orderGeneration = generation;
+		return true;
+	}
+	// The copy shares the column chunks, edits of the table after this do not reach the worker
+	jobGeneration = generation;
+	cancel = std::make_shared<std::atomic<bool>>(false);
+	job = std::async(std::launch::async, [table, keys, stop = cancel]() {
+		std::vector<int> order = SortRows(table, keys, stop.get());
+		RequestRedraw();
+		return order;
+		});
+	return changed;
+}
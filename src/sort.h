@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+#include "project.h"
+#include "retiredjobs.h"
+
+// Tables with at least this many rows are sorted on a worker thread
+constexpr std::size_t SORT_ASYNC_ROWS = 50000;
+
+struct SortKey {
+	ColId column = 0;
+	bool descending = false;
+	bool operator==(const SortKey&) const = default;
+};
+
+// Every row of table ordered by keys, the first key decides first. Numbers come before text
+// and empty cells (and NaN) always come last. Rows that compare equal keep their order.
+// Keys with unknown columns are ignored. Returns nothing once cancel is set.
+std::vector<int> SortRows(const SheetTable& table, const std::vector<SortKey>& keys, const std::atomic<bool>* cancel = nullptr);
+// Rows (e.g. a filter result) in the order of order, rows missing in order are appended ascending
+std::vector<int> OrderRows(const std::vector<int>& order, const std::vector<int>& rows);
+
+// Sort order that is kept between frames, only sorted again if the keys or the table version changed
+struct SortCache {
+	std::vector<int> order;	// rows of the last finished sort, empty without keys
+	std::uint64_t generation = 0;	// counts the changes of keys and table version
+
+	// Brings order up to date, returns true if order changed.
+	// Large tables are sorted on a worker thread over a copy of the table, order keeps the old result until it is done.
+	bool update(const SheetTable& table, const std::vector<SortKey>& keys);
+	bool pending() const { return job.valid(); }
+
+private:
+	struct Input {
+		std::vector<SortKey> keys;
+		std::uint64_t version = 0;
+		bool operator==(const Input&) const = default;
+	};
+	Input wanted;
+	std::uint64_t orderGeneration = 0;	// generation order was computed for
+	std::uint64_t jobGeneration = 0;
+	std::future<std::vector<int>> job;
+	std::shared_ptr<std::atomic<bool>> cancel;	// stops job
+	RetiredJobs<std::vector<int>> retired;	// cancelled jobs that did not stop yet
+};
@@ -0,0 +1,158 @@
+#include "trigramindex.h"
+#include "logging.h"
+#include "redraw.h"
+#include "timer.h"
+#include "workerpool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+static std::uint32_t trigram(const char* s) {
+	return (std::uint32_t)(unsigned char)s[0] << 16 | (std::uint32_t)(unsigned char)s[1] << 8 | (unsigned char)s[2];
+}
+
+const TrigramIndex::ChunkEntry* TrigramIndex::entry(const SheetTable& table, ColId column, std::size_t c) const {
+	if (column >= columns.size() || column >= table.columns.size() || c >= columns[column].size())
+		return nullptr;
+	const ChunkEntry* e = columns[column][c].get();
+	if (!e || c >= table.columns[column].values.chunk_count() || e->chunk.get() != table.columns[column].values.chunk(c))
+		return nullptr;
+	return e;
+}
+
+std::size_t TrigramIndex::memoryUsage() const {
+	std::size_t bytes = 0;
+	for (const auto& column : columns) {
+		for (const auto& e : column) {
+			bytes += e->trigrams.capacity() * sizeof(std::uint32_t) + e->offsets.capacity() * sizeof(std::uint32_t) + e->rows.capacity() * sizeof(std::uint16_t);
+		}
+	}
+	return bytes;
+}
+
+void TrigramCandidates(const TrigramIndex::ChunkEntry& entry, std::string_view text, std::vector<std::uint16_t>& out) {
+	out.clear();
+	if (text.size() < 3)
+		return;
+	// Posting list of every distinct trigram, the shortest one first
+	std::vector<std::pair<const std::uint16_t*, const std::uint16_t*>> lists;
+	for (std::size_t i = 0; i + 2 < text.size(); ++i) {
+		const std::uint32_t t = trigram(text.data() + i);
+		auto it = std::lower_bound(entry.trigrams.begin(), entry.trigrams.end(), t);
+		if (it == entry.trigrams.end() || *it != t)
+			return;
+		const std::size_t k = it - entry.trigrams.begin();
+		lists.emplace_back(entry.rows.data() + entry.offsets[k], entry.rows.data() + entry.offsets[k + 1]);
+	}
+	std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.second - a.first < b.second - b.first; });
+	lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+	out.assign(lists[0].first, lists[0].second);
+	std::vector<std::uint16_t> tmp;
+	for (std::size_t l = 1; l < lists.size() && !out.empty(); ++l) {
+		tmp.clear();
+		std::set_intersection(out.begin(), out.end(), lists[l].first, lists[l].second, std::back_inserter(tmp));
+		out.swap(tmp);
+	}
+}
+
+static std::shared_ptr<const TrigramIndex::ChunkEntry> build_entry(std::shared_ptr<const TrigramIndex::Chunk> chunk) {
+	auto e = std::make_shared<TrigramIndex::ChunkEntry>();
+	// trigram << 16 | row, sorting groups the rows of a trigram in ascending order
+	std::vector<std::uint64_t> pairs;
+	for (std::size_t r = 0; r < chunk->size(); ++r) {
+		const std::string& s = (*chunk)[r].second;
+		for (std::size_t i = 0; i + 2 < s.size(); ++i) {
+			pairs.push_back((std::uint64_t)trigram(s.data() + i) << 16 | r);
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+	e->rows.reserve(pairs.size());
+	for (const std::uint64_t pair : pairs) {
+		const std::uint32_t t = (std::uint32_t)(pair >> 16);
+		if (e->trigrams.empty() || e->trigrams.back() != t) {
+			e->trigrams.push_back(t);
+			e->offsets.push_back((std::uint32_t)e->rows.size());
+		}
+		e->rows.push_back((std::uint16_t)(pair & 0xFFFF));
+	}
+	e->offsets.push_back((std::uint32_t)e->rows.size());
+	e->chunk = std::move(chunk);
+	return e;
+}
+
+std::shared_ptr<const TrigramIndex> BuildTrigramIndex(const SheetTable& table, const TrigramIndex* previous) {
+	Timer t;
+	t.Start();
+	auto index = std::make_shared<TrigramIndex>();
+	// Entries of the last index by chunk, a chunk that did not change keeps its entry
+	std::unordered_map<const TrigramIndex::Chunk*, std::shared_ptr<const TrigramIndex::ChunkEntry>> known;
+	if (previous) {
+		for (const auto& column : previous->columns) {
+			for (const auto& e : column) {
+				known.emplace(e->chunk.get(), e);
+			}
+		}
+	}
+	std::size_t reused = 0;
+	std::vector<std::pair<ColId, std::size_t>> missing;
+	index->columns.resize(table.columns.size());
+	for (ColId c = 0; c < (ColId)table.columns.size(); ++c) {
+		const auto& values = table.columns[c].values;
+		index->columns[c].resize(values.chunk_count());
+		for (std::size_t k = 0; k < values.chunk_count(); ++k) {
+			auto it = known.find(values.chunk(k));
+			if (it != known.end()) {
+				index->columns[c][k] = it->second;
+				reused++;
+			}
+			else
+				missing.emplace_back(c, k);
+		}
+	}
+	// Every chunk is indexed on its own, workers take the next missing one
+	const std::size_t threads = std::min(missing.size(), WorkerCount());
+	std::atomic<std::size_t> next = 0;
+	ParallelFor(threads, [&](std::size_t) {
+		for (std::size_t i = next++; i < missing.size(); i = next++) {
+			const auto [c, k] = missing[i];
+			index->columns[c][k] = build_entry(table.columns[c].values.shared_chunk(k));
+		}
+		});
+	t.Stop();
+	index->chunksIndexed = missing.size();
+	index->chunksReused = reused;
+	index->buildMs = t.GetElapsedMilliseconds();
+	return index;
+}
+
+void TrigramIndexCache::update(const SheetTable& table) {
+	retired.poll();
+	if (job.valid() && job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		index = job.get();
+		// Logged here, logging is not thread safe
+		logging::loginfo("[TrigramIndexCache::update] Index built:\n\
+					Table:\t\t%s\n\
+					Chunks:\t\t%zu indexed, %zu reused\n\
+					Memory:\t\t%.1f MB\n\
+					Time:\t\t%.2fms", table.name.c_str(), index->chunksIndexed, index->chunksReused, index->memoryUsage() / (1024.0 * 1024.0), index->buildMs);
+	}
+	// One build at a time, edits during a build are picked up by the next one
+	if (job.valid() || (index && version == table.version) || !table.loaded)
+		return;
+	version = table.version;
+	// The copy shares the column chunks, the build does not race with edits of the table
+	job = std::async(std::launch::async, [table, previous = index]() {
+		auto index = BuildTrigramIndex(table, previous.get());
+		RequestRedraw();
+		return index;
+		});
+}
+
+void TrigramIndexCache::clear() {
+	retired.add(std::move(job));
+	job = {};
+	index.reset();
+	version = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "project.h"
+#include "retiredjobs.h"
+
+// Substring index over the display strings of a table, one trigram list per column chunk.
+// An entry holds its chunk, so editing a cell copies the chunk first (copy on write) and the entry stops matching the column.
+// Chunks without a matching entry are scanned instead, the index is never wrong, only incomplete.
+struct TrigramIndex {
+	using Chunk = decltype(Column::values)::Chunk;
+	struct ChunkEntry {
+		std::shared_ptr<const Chunk> chunk;
+		std::vector<std::uint32_t> trigrams;	// sorted
+		std::vector<std::uint32_t> offsets;	// rows of trigrams[i] are rows[offsets[i]] to rows[offsets[i + 1]]
+		std::vector<std::uint16_t> rows;	// rows within the chunk, ascending per trigram
+	};
+	std::vector<std::vector<std::shared_ptr<const ChunkEntry>>> columns;	// [column][chunk]
+	std::size_t chunksIndexed = 0;
+	std::size_t chunksReused = 0;	// taken over from the previous index
+	double buildMs = 0.0;
+
+	// Entry of chunk c of column if it still matches the table, nullptr otherwise
+	const ChunkEntry* entry(const SheetTable& table, ColId column, std::size_t c) const;
+	std::size_t memoryUsage() const;
+};
+
+// Rows of the chunk (ascending) that contain every trigram of text, text needs at least 3 bytes
+void TrigramCandidates(const TrigramIndex::ChunkEntry& entry, std::string_view text, std::vector<std::uint16_t>& out);
+
+// Builds the index of all columns in parallel, entries of previous whose chunk is still in the table are reused
+std::shared_ptr<const TrigramIndex> BuildTrigramIndex(const SheetTable& table, const TrigramIndex* previous = nullptr);
+
+// Keeps the trigram index of a table up to date in the background, only changed chunks are indexed again
+struct TrigramIndexCache {
+	std::shared_ptr<const TrigramIndex> index;	// last finished index, may lag behind the table
+
+	void update(const SheetTable& table);
+	bool pending() const { return job.valid(); }
+	void clear();
+
+private:
+	std::uint64_t version = 0;	// table version of the running or last job
+	std::future<std::shared_ptr<const TrigramIndex>> job;
+	RetiredJobs<std::shared_ptr<const TrigramIndex>> retired;	// builds for a cleared table, their index is dropped
+};
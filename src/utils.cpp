@@ -1,10 +1,42 @@
 #include "utils.h"
+#include <algorithm>
 #include <codecvt>
-#include <Windows.h>
 #include <fstream>
-
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
 
 bool s_CanDecodeAsCodePage(const std::vector<unsigned char>& bytes, UINT codePage);
+#else
+// Windows-1252 characters 0x80 - 0x9F, the rest of the code page is Latin-1
+static const char32_t CP1252_HIGH[32] = {
+	0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+	0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+static void s_AppendUTF8(std::string& out, char32_t cp) {
+	if (cp < 0x80) {
+		out.push_back((char)cp);
+	}
+	else if (cp < 0x800) {
+		out.push_back((char)(0xC0 | (cp >> 6)));
+		out.push_back((char)(0x80 | (cp & 0x3F)));
+	}
+	else if (cp < 0x10000) {
+		out.push_back((char)(0xE0 | (cp >> 12)));
+		out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+		out.push_back((char)(0x80 | (cp & 0x3F)));
+	}
+	else {
+		out.push_back((char)(0xF0 | (cp >> 18)));
+		out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+		out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+		out.push_back((char)(0x80 | (cp & 0x3F)));
+	}
+}
+#endif
 
 std::string GetLastWriteTime(const std::filesystem::path& path) {
 	using namespace std::chrono;
@@ -69,6 +101,7 @@ bool IsValidUTF8(const std::string& str){
 	return true;
 }
 
+#ifdef _WIN32
 std::string Convert1252ToUTF8(const std::string& input){
 	// Convert Windows-1252 to UTF-16
 	int wideLen = MultiByteToWideChar(1252, 0, input.c_str(), -1, NULL, 0);
@@ -125,6 +158,52 @@ std::string AnsiToUtf8(const std::string& ansi){
 	return u8;
 }
 
+#else
+std::string Convert1252ToUTF8(const std::string& input){
+	std::string utf8Str;
+	utf8Str.reserve(input.size());
+	for (unsigned char c : input) {
+		if (c >= 0x80 && c < 0xA0)
+			s_AppendUTF8(utf8Str, CP1252_HIGH[c - 0x80]);
+		else
+			s_AppendUTF8(utf8Str, c);
+	}
+	return utf8Str;
+}
+
+std::string ConvertUTF8To1252(const std::string& input){
+	std::string ansiStr;
+	ansiStr.reserve(input.size());
+	for (std::size_t i = 0; i < input.size();) {
+		unsigned char c = (unsigned char)input[i];
+		char32_t cp = c;
+		std::size_t len = 1;
+		if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; len = 2; }
+		else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; len = 3; }
+		else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; len = 4; }
+		if (i + len > input.size())
+			return "";
+		for (std::size_t k = 1; k < len; k++) {
+			cp = (cp << 6) | ((unsigned char)input[i + k] & 0x3F);
+		}
+		i += len;
+		if (cp < 0x80 || (cp >= 0xA0 && cp <= 0xFF)) {
+			ansiStr.push_back((char)cp);
+			continue;
+		}
+		const char32_t* it = std::find(std::begin(CP1252_HIGH), std::end(CP1252_HIGH), cp);
+		// Characters the code page does not have become '?' like on Windows
+		ansiStr.push_back(it != std::end(CP1252_HIGH) ? (char)(0x80 + (it - std::begin(CP1252_HIGH))) : '?');
+	}
+	return ansiStr;
+}
+
+// There is no system code page outside of Windows, files written by Windows tools are Windows-1252
+std::string AnsiToUtf8(const std::string& ansi){
+	return Convert1252ToUTF8(ansi);
+}
+#endif
+
 std::string StrToWstr(const std::string& input){
 	std::wstring wstr;
 	try {
@@ -261,7 +340,7 @@ std::string ExcelSerialToDate(int serial) {
 }
 
 Encoding DetectEncoding(const std::wstring& path){
-	std::ifstream file(path, std::ios::binary);
+	std::ifstream file(std::filesystem::path(path), std::ios::binary);
 	if (!file) return Encoding::BINARY_OR_UNKNOWN;
 
 	// Read first few bytes for BOM
@@ -335,6 +414,7 @@ Encoding DetectEncoding(const std::wstring& path){
 	return Encoding::ANSI;
 }
 
+#ifdef _WIN32
 void convertContentToUTF8(std::string* content){
 	std::vector<unsigned char> bytes(content->begin(), content->end());
 	// Alreade is UTF8?
@@ -360,5 +440,12 @@ bool s_CanDecodeAsCodePage(const std::vector<unsigned char>& bytes, UINT codePag
 	);
 	return result > 0;   // 0 => failure (invalid char sequence)
 }
-
-
+#else
+void convertContentToUTF8(std::string* content){
+	// Alreade is UTF8?
+	if (IsValidUTF8(*content)) {
+		return;
+	}
+	*content = AnsiToUtf8(*content);
+}
+#endif
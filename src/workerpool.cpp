@@ -0,0 +1,102 @@
+#include "workerpool.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// One ParallelFor call. Workers that pick it up after every index is taken do nothing,
+// so the task is only called while the caller still waits for it.
+struct Job {
+	std::size_t count = 0;
+	const std::function<void(std::size_t)>* task = nullptr;
+	std::atomic<std::size_t> next = 0;
+	std::atomic<std::size_t> done = 0;
+	std::mutex mutex;
+	std::condition_variable finished;
+
+	void work() {
+		for (std::size_t i = next++; i < count; i = next++) {
+			(*task)(i);
+			if (++done == count) {
+				std::lock_guard lock(mutex);
+				finished.notify_all();
+			}
+		}
+	}
+};
+
+class Pool {
+public:
+	Pool() {
+		const std::size_t threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+		for (std::size_t t = 0; t < threads; ++t) {
+			workers.emplace_back([this]() { loop(); });
+		}
+	}
+	std::size_t size() const { return workers.size() + 1; }
+	void push(const std::shared_ptr<Job>& job, std::size_t helpers) {
+		{
+			std::lock_guard lock(mutex);
+			for (std::size_t h = 0; h < helpers; ++h) {
+				queue.push_back(job);
+			}
+		}
+		if (helpers == 1)
+			wake.notify_one();
+		else if (helpers > 1)
+			wake.notify_all();
+	}
+
+private:
+	void loop() {
+		while (true) {
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock lock(mutex);
+				wake.wait(lock, [this]() { return !queue.empty(); });
+				job = std::move(queue.front());
+				queue.pop_front();
+			}
+			job->work();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::shared_ptr<Job>> queue;
+	std::vector<std::jthread> workers;
+};
+
+// Never destroyed, background jobs that still run while the statics go away at exit may use it
+Pool& pool() {
+	static Pool* instance = new Pool();
+	return *instance;
+}
+
+}
+
+std::size_t WorkerCount() {
+	return pool().size();
+}
+
+void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& task) {
+	if (count == 0)
+		return;
+	if (count == 1) {
+		task(0);
+		return;
+	}
+	auto job = std::make_shared<Job>();
+	job->count = count;
+	job->task = &task;
+	pool().push(job, std::min(count, pool().size()) - 1);
+	job->work();
+	std::unique_lock lock(job->mutex);
+	job->finished.wait(lock, [&]() { return job->done == count; });
+}
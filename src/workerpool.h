@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+// Worker threads that live as long as the program, shared by filtering, sorting, grouping and index builds
+// so a search per keystroke does not start new threads.
+
+// Threads a ParallelFor spreads over, the calling thread included
+std::size_t WorkerCount();
+// Calls task(i) for every i in [0, count) on the pool and the calling thread, returns once all calls are done.
+// The calling thread always takes part, so tasks may call ParallelFor themselves and a busy pool only costs time.
+void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& task);
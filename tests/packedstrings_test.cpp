@@ -0,0 +1,95 @@
+#include "packedstrings.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	if (!ok) {
+		std::printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+// Few distinct letters so short needles match often and long ones sometimes
+static std::string random_text(std::mt19937& rng, std::size_t length) {
+	std::string text;
+	for (std::size_t i = 0; i < length; i++) {
+		text += "aab"[rng() % 3];
+	}
+	return text;
+}
+
+// FindSubstring against std::string_view::find for every start position
+static void check_find(std::string_view haystack, std::string_view needle, const char* what) {
+	for (std::size_t from = 0; from <= haystack.size() + 1; from++) {
+		if (FindSubstring(haystack, needle, from) != haystack.find(needle, from)) {
+			check(false, what);
+			return;
+		}
+	}
+}
+
+static std::vector<std::uint16_t> expected_rows(const PackedChunk::Chunk& chunk, std::string_view needle) {
+	std::vector<std::uint16_t> rows;
+	for (std::size_t r = 0; r < chunk.size(); r++) {
+		// A needle starting with '\0' is a prefix search
+		const std::string cell = '\0' + chunk[r].second;
+		if (cell.find(needle) != std::string::npos)
+			rows.push_back((std::uint16_t)r);
+	}
+	return rows;
+}
+
+int main() {
+	std::mt19937 rng(11);
+	// Needles around the 16 byte block of the SSE2 loop, at every position of haystacks around it
+	for (std::size_t k : { 1, 2, 3, 15, 16, 17, 33 }) {
+		for (std::size_t length = 0; length < 80; length++) {
+			const std::string haystack = random_text(rng, length);
+			check_find(haystack, random_text(rng, k), "random needle");
+			// Needle at the very end, the last block load ends on the last byte
+			if (length >= k)
+				check_find(haystack, haystack.substr(length - k), "needle at the end of the buffer");
+			if (length >= k)
+				check_find(haystack, haystack.substr(0, k), "needle at the start of the buffer");
+		}
+	}
+	check(FindSubstring("abc", "", 1) == 1, "empty needle");
+	check(FindSubstring("abc", "abcd") == std::string_view::npos, "needle longer than the haystack");
+
+	// Chunks with matches in the first and last row and at the end of the packed bytes
+	for (int round = 0; round < 50; round++) {
+		auto chunk = std::make_shared<PackedChunk::Chunk>();
+		const std::size_t rows = 1 + rng() % 300;
+		for (std::size_t r = 0; r < rows; r++) {
+			const std::string text = random_text(rng, rng() % 40);
+			chunk->emplace_back(text, text);
+		}
+		const auto packed = PackChunk(chunk);
+		check(packed->offsets.size() == rows + 1 && packed->offsets.back() == packed->bytes.size(), "offsets");
+		const std::string& last = chunk->back().second;
+		std::vector<std::string> needles = { "a", "ab", "ba", random_text(rng, 16), random_text(rng, 17) };
+		if (last.size() >= 2)
+			needles.push_back(last.substr(last.size() - 2));
+		if (last.size() >= 17)
+			needles.push_back(last.substr(last.size() - 17));
+		if (!chunk->front().second.empty())
+			needles.push_back(chunk->front().second);
+		// Prefix searches as the filter sends them
+		needles.push_back(std::string(1, '\0') + "a");
+		needles.push_back(std::string(1, '\0') + "ba");
+		needles.push_back('\0' + last);
+		std::vector<std::uint16_t> found;
+		for (const std::string& needle : needles) {
+			PackedFind(*packed, needle, found);
+			check(found == expected_rows(*chunk, needle), "PackedFind rows");
+		}
+	}
+	if (failures == 0)
+		std::printf("packedstrings_test passed\n");
+	return failures == 0 ? 0 : 1;
+}
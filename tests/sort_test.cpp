@@ -0,0 +1,75 @@
+#include "sort.h"
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+	if (!ok) {
+		std::printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static SheetTable mixed_table(std::size_t rows) {
+	SheetTable table;
+	table.loaded = true;
+	table.columns.resize(1);
+	table.columns[0].key = { "Value", 0 };
+	table.byName["Value"] = { 0 };
+	std::mt19937 rng(7);
+	for (std::size_t r = 0; r < rows; r++) {
+		const int kind = rng() % 5;
+		const double number = (double)(rng() % 1000) / 10.0;
+		if (kind == 0)
+			table.columns[0].values.emplace_back(std::numeric_limits<double>::quiet_NaN(), "nan");
+		else if (kind == 1)
+			table.columns[0].values.emplace_back(std::monostate{}, "");
+		else
+			table.columns[0].values.emplace_back(number, std::to_string(number));
+	}
+	table.rowCount = rows;
+	return table;
+}
+
+static bool unordered(const ExcelValue& value) {
+	const auto* d = std::get_if<double>(&value);
+	return !d || std::isnan(*d);
+}
+
+// Numbers in key order first, then NaN and empty cells in row order
+static bool sorted(const SheetTable& table, const std::vector<int>& order, bool descending) {
+	if (order.size() != table.rowCount)
+		return false;
+	const auto& values = table.columns[0].values;
+	std::size_t i = 0;
+	for (; i < order.size() && !unordered(values[order[i]].first); i++) {
+		if (i == 0)
+			continue;
+		const double previous = std::get<double>(values[order[i - 1]].first);
+		const double current = std::get<double>(values[order[i]].first);
+		if (descending ? previous < current : current < previous)
+			return false;
+	}
+	for (std::size_t j = i; j < order.size(); j++) {
+		if (!unordered(values[order[j]].first) || (j > i && order[j] < order[j - 1]))
+			return false;
+	}
+	return true;
+}
+
+int main() {
+	// Small tables are sorted with one std::sort, large ones with ParallelSort
+	for (std::size_t rows : { 1000, 200000 }) {
+		const SheetTable table = mixed_table(rows);
+		check(sorted(table, SortRows(table, { { 0, false } }), false), "nan mixed with numbers, ascending");
+		check(sorted(table, SortRows(table, { { 0, true } }), true), "nan mixed with numbers, descending");
+	}
+	if (failures == 0)
+		std::printf("sort_test passed\n");
+	return failures == 0 ? 0 : 1;
+}